@@ -96,6 +96,10 @@ private:
     ParameterToggle linkFilters;
     ParameterControl falloff;
     ParameterControl wetDry;
+
+#if JUCE_DEBUG
+    juce::Label subnormalLabel;
+#endif
     
     bool tempoSyncOn;
     int tempoSyncNoteIndex;
@@ -1,10 +1,15 @@
 #pragma once
+#include <atomic>
 #include <vector>
 #include <juce_audio_processors/juce_audio_processors.h>
 #include <melatonin_perfetto/melatonin_perfetto.h>
 #include "CircularBuffer.h"
+#include "CoefficientBank.h"
 #include "DelayAmp.h"
+#include "DspArena.h"
 #include "Filter.h"
+#include "ParameterSnapshot.h"
+#include "TapPlan.h"
 
 typedef struct NoteValue
 {
@@ -13,11 +18,38 @@ typedef struct NoteValue
 }
 NoteValue;
 
-class PluginProcessor final : public juce::AudioProcessor
+typedef struct TapGains
+{
+    float leftStart;
+    float leftEnd;
+    float rightStart;
+    float rightEnd;
+}
+TapGains;
+
+// How the taps use the delay line. In place, each tap filters the samples it
+// reads and writes them back for the taps after it. Read only, the delay line
+// keeps its input untouched and each tap runs it through a cascade of filters
+// of its own, one stage for each interval up to and including it.
+enum class HistoryMode
+{
+    inPlace,
+    readOnly
+};
+
+class PluginProcessor final :
+    public juce::AudioProcessor,
+    public juce::AudioProcessorValueTreeState::Listener,
+    public juce::ValueTree::Listener,
+    private juce::AsyncUpdater
 {
 public:
     juce::AudioProcessorValueTreeState tree;
 
+    // settings that belong to the machine rather than to a preset, so they
+    // aren't saved with the plugin's state (change them on the message thread)
+    juce::ValueTree settings;
+
     PluginProcessor();
     ~PluginProcessor() override;
 
@@ -97,6 +129,7 @@ public:
     double getTailLengthSeconds() const override;
     bool isBusesLayoutSupported(const BusesLayout& layouts) const override;
     float getSecondsForNoteValue(int index);
+    float getMaxDelayTime() const;
 
     void prepareToPlay(double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
@@ -109,10 +142,23 @@ public:
     void copyLeftAmpsToRight();
     void copyRightAmpsToLeft();
 
-    void linkFilters();
-    void unlinkFilters();
-    void linkDelays();
-    void unlinkDelays();
+    void parameterChanged(const juce::String& id, float value) override;
+    void valueTreePropertyChanged(juce::ValueTree& changed,
+        const juce::Identifier& property) override;
+
+    void setDelayCrossfadeTime(float milliseconds);
+    void setFilterEngine(FilterEngine engine);
+    void setHistoryMode(HistoryMode mode);
+    void setDelayStorage(DelayStorage storage);
+    void setDelayMemoryLocked(bool shouldLock);
+
+    // the number of subnormal values left in the filter states, the looped
+    // signal and the output by the last block (only counted in debug builds)
+    size_t getSubnormalCount() const;
+
+    // a description of where each working buffer sits in the DSP arena, for
+    // diagnostics only (call it from the message thread between prepares)
+    juce::String getArenaMemoryMap() const;
 
     void getStateInformation(juce::MemoryBlock& destData) override;
     void setStateInformation(const void* data, int sizeInBytes) override;
@@ -122,21 +168,53 @@ public:
 
 private:
     static constexpr int maxIntervals = 16;
+    // in read-only mode the loop head runs through a stage for every interval
+    static_assert(maxIntervals <= Filter::maxCascadeStages);
+    static_assert(maxIntervals <= TapPlan::maxTaps);
+    static_assert(maxIntervals == ParameterSnapshot::numAmps);
+    static constexpr size_t numFilterSets = 2;
+    // host blocks are processed in sub-blocks of at most this many samples,
+    // so that the scratch buffers and tap windows stay in cache
+    static constexpr size_t maxSubBlockSize = 256;
+    static constexpr int numTempChannels = 4;
     static const float maxDelayTime;
 
+    // the crossfade times on offer, in milliseconds
+    static constexpr size_t numCrossfadeTimes = 5;
+    static const int crossfadeTimes[numCrossfadeTimes];
+    static constexpr int defaultCrossfadeTime = 2; // index of 50 ms
+
+    // the first snapshot parameter of those that the right amps and the
+    // right filters follow, for one combination of the links
+    struct LinkRoute
+    {
+        size_t rightAmps;
+        size_t rightFilters;
+    };
+
+    // a route's index has a bit for each link that's on
+    static constexpr size_t delaysLink = 0;
+    static constexpr size_t filtersLink = 1;
+    static constexpr size_t numLinks = 2;
+    static constexpr size_t numLinkRoutes = 1 << numLinks;
+    static const LinkRoute linkRoutes[numLinkRoutes];
+
     static constexpr size_t numNoteValues = 6;
     static const NoteValue noteValues[numNoteValues];
     
+    ParameterSnapshot snapshot;
     double lastSampleRate;
     double lastBpm;
-    bool lastAmpsLinked;
-    bool lastFiltersLinked;
+    std::atomic<double> tailLength; // seconds, as the host is told
     
     size_t numSamples;
+    float blockFraction; // share of the rest of the host block being processed
     size_t currentDelay;
-    size_t lastBlockDelay;
+    size_t activeDelay; // tap spacing the delay line is processed at
+    size_t fadingDelay; // tap spacing being crossfaded away from
     size_t currentNumIntervals;
-    size_t lastBlockNumIntervals;
+    size_t activeNumIntervals;
+    size_t fadingNumIntervals;
 
     float currentWet;
     float lastBlockWet;
@@ -145,40 +223,86 @@ private:
 
     bool loop;
     bool lastBlockLoop;
-    bool fadeOut;
-    bool lastBlockFadeOut;
 
-    CircularBuffer leftBuffer;
-    CircularBuffer rightBuffer;
+    std::atomic<float> crossfadeTime; // milliseconds, set from any thread
+    size_t crossfadeLength;
+    size_t crossfadePosition;
+    float crossfadeStart;
+    float crossfadeEnd;
+    bool crossfading;
+
+    CircularBuffer delayLine; // shared by both channels, stored interleaved
     DelayAmp leftAmps[maxIntervals];
     DelayAmp rightAmps[maxIntervals];
-    Filter leftFilters[maxIntervals];
-    Filter rightFilters[maxIntervals];
+    CoefficientBank leftCoefficients;
+    CoefficientBank rightCoefficients;
+    const CoefficientBank* activeRightCoefficients;
+    bool rightCoefficientsShared; // right filters use the left coefficients
+    Filter leftFilters[numFilterSets][maxIntervals];
+    Filter rightFilters[numFilterSets][maxIntervals];
+    size_t activeFilterSet;
+    size_t activeLoopFilterSet; // the loop head only uses filter 0 of a set
+    std::atomic<FilterEngine> requestedFilterEngine;
+    HistoryMode historyMode;
+    std::atomic<HistoryMode> requestedHistoryMode;
+    std::atomic<DelayStorage> requestedDelayStorage;
+    std::atomic<bool> lockDelayMemory;
+    TapPlan tapPlan;
+    size_t activeLinkRoute;
+    size_t fadingLinkRoute; // route being faded away from
+    size_t linkFadePositions[numLinks];
+    std::atomic<size_t> lastBlockSubnormals;
 
-    std::vector<float> tempBuffer; // for operating on signal in processBlock
+    DspArena arena; // every buffer the sub-blocks are processed in
+    float* tempChannels[numTempChannels];
+    juce::AudioBuffer<float> tempBuffer; // for operating on signal in blocks
 #if PERFETTO
     std::unique_ptr<perfetto::TracingSession> tracingSession;
 #endif
 
     void handleTempoSync();
     void handleParameterLinking();
+    void attachParameters();
+    void resetParameterTargets();
+    void updateParameterTargets();
+    static size_t getLinkBit(size_t link);
+    bool isLinkFading(size_t link);
+    float advanceLinkFade(size_t link);
+    void finishLinkFade(size_t link);
+    float getRoutedValue(size_t from, size_t to, float fade);
+    float getRampedValue(float last, float target);
     void updateCurrentBlockParameters();
     void updateLastBlockParameters();
     void updateParametersOnReset();
+    void handleAsyncUpdate() override;
+    void updateCrossfade();
+    void startCrossfade();
+    void updateTailLength();
+    void updateCrossfadeLength();
+    void updateFilterCoefficients();
+    void updateHistoryMode();
+    void resetFilters();
+    void prepareDelayLine(size_t subBlockSize);
+    void allocateArenaBlocks(size_t subBlockSize);
 
-    void processChannel(float* audio, CircularBuffer* buffer, DelayAmp* amps,
-        Filter* filters);
-    void processDrySignal(float* audio, float ampStart, float ampEnd);
-    void processLoopedSignal(float* audio, CircularBuffer* buffer,
-        float ampStart, float ampEnd, Filter* filters);
-    void processWetSignal(float* audio, CircularBuffer* buffer, DelayAmp* amps,
-        Filter* filters);
+    void processChannels(float* left, float* right);
+    void processLoopedSignal();
+    void processWetSignal();
+    void processCrossfadedTap(size_t interval, float* leftOut,
+        float* rightOut, TapGains gains);
+    void processHead(size_t delay, size_t filterSet, size_t filterIndex,
+        size_t numStages, float* leftOut, float* rightOut, TapGains gains,
+        float levelStart, float levelEnd, bool inPlace);
+    size_t countSubnormals(const float* left, const float* right);
+    void mixOutput(float* audio, const float* wetSignal,
+        const float* loopSignal, float dryStart, float dryEnd);
 
     BusesProperties createBusesProperties();
     juce::AudioProcessorValueTreeState::ParameterLayout createParameters();
 
     size_t getDelaySamples();
     size_t getCurrentNumIntervals();
+    size_t getDelayLineLength(size_t delay, size_t numIntervals);
 
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PluginProcessor)
 };
@@ -1,42 +1,245 @@
 #pragma once
+#include <atomic>
+#include <memory>
 #include <vector>
+#include <juce_core/juce_core.h>
+#include "DelayMemory.h"
+#include "DspArena.h"
+#include "SampleKernels.h"
 
 class Filter;
+class CoefficientBank;
 
+// How the delay line stores its samples. The 16-bit formats halve its memory
+// and the bandwidth the taps use reading it, at the cost of some noise. Half
+// precision's noise follows the level of the signal, while dithered 16-bit
+// integers have a fixed noise floor (see SampleKernels)
+enum class DelayStorage
+{
+    float32,
+    half,
+    dithered16
+};
+
+// A stereo delay line. Samples are stored as interleaved frames (L, R, L, R,
+// ...) so that reading or writing both channels at a given delay touches the
+// same cache lines. Delays and lengths are measured in frames.
+//
+// Clearing is lazy: clear() only restarts the frame count, and any frame
+// older than the frames written since is treated as silence. Such frames are
+// zeroed when a read first reaches them, so the cost of a clear is spread
+// across the reads that follow it instead of touching the whole buffer.
+//
+// The buffer is only as long as the delays in use need. When they need more,
+// a longer buffer is allocated on a background thread shared by every delay
+// line, which also copies the history across as it was when the buffer was
+// asked for. The audio thread then only copies the frames written since
+// (the new input, and the runs its taps have filtered in place) as it
+// swaps the longer buffer in, so growing never allocates on the audio thread
+// or copies more than a few blocks' worth of frames there.
+//
+// The memory is split into segments of at most segmentBytes each. A short
+// delay line is a single segment, a power of two frames long, while a longer
+// one is as many full segments as it needs.
+//
+// In the 16-bit storage formats, the frames a read or write touches are
+// unpacked into (or packed from) float frames in a staging buffer, so every
+// kernel that processes frames works the same whatever the storage.
 class CircularBuffer
 {
 public:
+    static constexpr size_t numChannels = 2;
+
+    // A run of frames in the buffer. When the buffer's memory is mirrored
+    // the whole run is contiguous and numPostWrap is always zero; otherwise
+    // the run continues from the start of the buffer after the wrap point.
+    struct Window
+    {
+        float* samples;
+        size_t numPreWrap;
+        float* wrapped;
+        size_t numPostWrap;
+    };
+
+    // One channel's half of a tap: the filter run over that channel's
+    // samples (and the coefficients it uses), and the buffer its output is
+    // summed into with a gain ramp
+    struct TapOutput
+    {
+        Filter* filter;
+        const CoefficientBank* coefficients;
+        float* output;
+        float startAmp;
+        float endAmp;
+    };
+
+    // An in-place tap processed alongside others by processTaps
+    struct LockStepTap
+    {
+        size_t delay;
+        TapOutput left;
+        TapOutput right;
+    };
+
+    static constexpr size_t maxLockStepTaps = 16;
+
     // Lifecycle
     CircularBuffer();
     CircularBuffer(size_t capacity);
+    ~CircularBuffer();
 
     // Add Samples
-    void addSample(const float sample);
-    void addSamples(const float* samples, size_t numToAdd);
-    void addSamplesRamped(const float* samples, size_t numToAdd);
+    void addSamples(const float* left, const float* right, size_t numToAdd);
+    void addSamplesWithFeedback(const float* left, const float* right,
+        const float* feedbackLeft, const float* feedbackRight,
+        size_t numToAdd, float startGain, float gainStep);
 
     // Get Samples
-    float getSample(size_t delay);
-    void getSamples(size_t delay, float* output, size_t length);
-    void sumWithSamples(size_t delay, float* output, size_t length,
-        float gain = 1.0f);
-    void sumWithSamplesRamped(size_t delay, float* output, size_t length,
-        float startGain = 0, float endGain = 1);
+    Window getWindow(size_t delay, size_t length, size_t stagingSlot = 0);
 
     // Manipulate Samples
-    void applyGainToSamples(size_t delay, size_t length, float gain);
-    void applyGainToSamples(size_t delay, size_t length, float startGain,
-        float endGain);
-    void applyFilterToSamples(size_t delay, size_t length, Filter* filter);
+    void processTap(size_t delay, size_t length, float startGain,
+        float endGain, TapOutput left, TapOutput right, bool inPlace = true);
+    void processTaps(const LockStepTap* taps, size_t numTaps, size_t length,
+        float startGain, float endGain);
+    void processCascadedTap(size_t delay, size_t length, size_t numStages,
+        float startGain, float endGain, TapOutput left, TapOutput right);
+
+    // Capacity
+    void resize(size_t newLength);
+    void prepare(size_t minLength, size_t maxBlockLength,
+        DelayStorage newStorage);
+    bool grow(size_t minLength);
+    void allocate(DspArena& arena);
+    void setLocked(bool shouldLock);
 
     // Other Operations
     void clear();
-    void resize(size_t newLength);
-    void resize(double sampleRate, float maxDelaySeconds);
     
 private:
-    std::vector<float> buffer;
+    typedef std::vector<std::unique_ptr<DelayMemory>> Segments;
+
+    // the thread delay lines are grown on, shared by every instance. It
+    // sleeps until a delay line has something for it to do
+    class GrowthThread : public juce::Thread
+    {
+    public:
+        GrowthThread();
+        ~GrowthThread() override;
+
+        void addBuffer(CircularBuffer* buffer);
+        void removeBuffer(CircularBuffer* buffer);
+        void run() override;
+
+    private:
+        juce::CriticalSection lock;
+        juce::Array<CircularBuffer*> buffers;
+    };
+
+    // the audio thread asks for a longer buffer (requested), the growth
+    // thread allocates it and copies the history into it (ready), the audio
+    // thread swaps it in and hands back the old one (retired), and the
+    // growth thread frees that (idle). A request the buffer has been
+    // replaced or cleared since goes straight back to idle
+    enum class Growth
+    {
+        idle,
+        requested,
+        ready,
+        retired
+    };
+
+    // where a run of frames lies: the segment and frame it starts at, how
+    // many of its frames are there, and the segment the rest continue in
+    // (from that segment's first frame)
+    struct Span
+    {
+        size_t segment;
+        size_t frame;
+        size_t numPreWrap;
+        size_t nextSegment;
+    };
+
+    // a run of frames the taps filtered in place while a longer buffer was
+    // being filled, which has to be copied to it again
+    struct Rewrite
+    {
+        size_t startSample;
+        size_t length;
+    };
+
+    static constexpr size_t segmentBytes = 2 << 20; // one huge page
+    static constexpr size_t maxRewrites = 64;
+
+    Segments segments;
+    size_t segmentLength;
+    size_t capacity;
     size_t sampleCount;
+    std::atomic<size_t> numClears; // read by the growth thread
+    DelayStorage storage;
+
+    // one window's float frames for each tap processTaps may run at once,
+    // in the processor's arena
+    float* staging;
+    size_t maxStagedFrames;
+    SampleKernels::DitherState dither;
+
+    // the buffer being grown into, and what the buffer was like when it was
+    // asked for: the history up to snapshotCount is copied by the growth
+    // thread, and anything after that by the audio thread
+    Segments spare;
+    size_t spareCapacity;
+    size_t spareSegmentLength;
+    DelayStorage spareStorage;
+    size_t grownFrom; // the capacity the spare was asked for at
+    size_t snapshotCount;
+    size_t snapshotClears;
+    Rewrite rewrites[maxRewrites];
+    size_t numRewrites;
+    bool trackingRewrites;
+    bool rewritesOverflowed;
+
+    // held by the growth thread while it reads the buffer, and by anything
+    // replacing the buffer from outside the audio thread
+    juce::CriticalSection layoutLock;
+    std::atomic<bool> lockMemory; // whether grown buffers are locked too
+    std::atomic<Growth> growth;
+    juce::SharedResourcePointer<GrowthThread> growthThread;
+
+    void serviceGrowth();
+    bool isSnapshotCurrent();
+    bool canSwapInSpare();
+    void swapInSpare();
+    void trackRewrite(size_t delay, size_t length);
+    void copyFrames(const Segments& from, size_t fromCapacity,
+        Segments& to, size_t toCapacity, size_t firstSample,
+        size_t numFrames);
+    void zeroFrames(Segments& table, size_t tableCapacity,
+        size_t firstSample, size_t numFrames);
+    unsigned char* locate(const Segments& table, size_t tableCapacity,
+        size_t sample, size_t& numInSegment);
 
-    size_t capacityMask(size_t sample);
+    static size_t getLengthFor(size_t minLength, DelayStorage storage);
+    static size_t getSegmentLength(size_t length, DelayStorage storage);
+    static size_t getBytesPerSample(DelayStorage storage);
+    static size_t getMemoryLength(size_t frames, DelayStorage storage);
+    static std::unique_ptr<DelayMemory> allocateSegment(size_t length,
+        DelayStorage storage, bool locked);
+    bool isPacked();
+    uint16_t* getPackedSamples(size_t segment);
+    size_t getStartSample(size_t delay, size_t length);
+    Window beginWrite(size_t numToAdd);
+    void endWrite(const Window& run, size_t numToAdd);
+    void writeBack(const Window& window, size_t delay, size_t length);
+    void packFrames(size_t startSample, const float* frames, size_t length);
+    void unpackFrames(float* frames, size_t startSample, size_t length);
+    Span getSpan(size_t startSample, size_t length);
+    void zeroStaleFrames(const Window& window, size_t delay, size_t length);
+    Window getRun(size_t startSample, size_t length);
+    void processTapChannel(const Window& window, size_t channel,
+        size_t length, float startGain, float gainStep, TapOutput tap,
+        bool inPlace);
+    void processCascadedTapChannel(const Window& window, size_t channel,
+        size_t length, size_t numStages, float startGain, float gainStep,
+        TapOutput tap);
 };
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+#include <juce_dsp/juce_dsp.h>
+#include "CoefficientTable.h"
+#include "DspArena.h"
+
+// How the interval filters are computed. The biquads redesign their
+// coefficients every smoothGrain samples while a cutoff moves, whereas the
+// state variable filters take a new cutoff every sample at no extra cost
+enum class FilterEngine
+{
+    biquad,
+    stateVariable
+};
+
+// The filter coefficients for one set of filter parameters (one side of the
+// plugin). Every interval's filter on that side shares the same cutoffs, so
+// the coefficients are looked up once per block, for each smoothing grain,
+// and read by all of them. The per-block coefficients live in the
+// processor's DspArena, so nothing is allocated while processing.
+class CoefficientBank
+{
+public:
+    typedef CoefficientTable::Biquad Biquad;
+    typedef CoefficientTable::StateVariable StateVariable;
+
+    static constexpr size_t smoothGrain = 10;
+
+    // Lifecycle
+    CoefficientBank();
+
+    // Parameters
+    void setParameters(float highPassCutoff, float lowPassCutoff,
+        float mixPercent);
+
+    // Engine
+    void setEngine(FilterEngine);
+    FilterEngine getEngine() const;
+
+    // Per Block
+    void prepare(const juce::dsp::ProcessSpec&, int rampLength);
+    void allocate(DspArena& arena, const juce::String& side);
+    void prepareBlock(size_t numSamples);
+    void skipBlock(size_t numSamples);
+    bool matches(const CoefficientBank& other) const;
+
+    // Reading The Current Block
+    size_t getGrainLength() const;
+    const Biquad& getHighPass(size_t grain) const;
+    const Biquad& getLowPass(size_t grain) const;
+    const float* getMix() const;
+    size_t getMixStride() const;
+    bool isFullyWet() const;
+    const StateVariable* getStateVariableHighPass() const;
+    const StateVariable* getStateVariableLowPass() const;
+    size_t getStateVariableStride() const;
+
+private:
+    juce::SmoothedValue<float> highPassFreq;
+    juce::SmoothedValue<float> lowPassFreq;
+    juce::SmoothedValue<float> smoothMix;
+
+    juce::SharedResourcePointer<CoefficientTable> coefficientTable;
+    const CoefficientTable::Designs* designs;
+    FilterEngine engine;
+
+    size_t maxSamples; // the longest block the arena has room for
+
+    Biquad currentHighPass;
+    Biquad currentLowPass;
+    Biquad* highPass; // one per grain of the current block
+    Biquad* lowPass;
+    float* mix; // one per sample of the current block
+    size_t mixStride; // 0 when the mix isn't moving
+    size_t grainLength;
+
+    StateVariable currentStateVariableHighPass;
+    StateVariable currentStateVariableLowPass;
+    StateVariable* stateVariableHighPass; // one per sample
+    StateVariable* stateVariableLowPass;
+    size_t stateVariableStride; // 0 when the cutoffs aren't moving
+
+    // Helper Functions
+    void updateCurrentCoefficients();
+    void prepareBiquadBlock(size_t numSamples);
+    void prepareStateVariableBlock(size_t numSamples);
+    static void interpolate(const StateVariable& start,
+        const StateVariable& end, StateVariable* output, size_t length);
+    Biquad makeHighPass(float freq) const;
+    Biquad makeLowPass(float freq) const;
+};
\ No newline at end of file
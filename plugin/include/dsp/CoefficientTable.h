@@ -0,0 +1,75 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include <juce_core/juce_core.h>
+
+// High-pass and low-pass designs worked out ahead of time over the range of
+// the cutoff parameters, so that sweeping a cutoff costs a table lookup
+// instead of a filter design. Each sample rate gets its own read-only table,
+// built the first time it's asked for and shared by every instance of the
+// plugin in the process (through a juce::SharedResourcePointer).
+class CoefficientTable
+{
+public:
+    // Normalised biquad coefficients (a0 is always 1)
+    struct Biquad
+    {
+        float b0;
+        float b1;
+        float b2;
+        float a1;
+        float a2;
+    };
+
+    // Coefficients for a TPT (topology-preserving transform) state variable
+    // filter with the same Q, which gives its low-pass and high-pass outputs
+    // from a single update. Aligned so that a set loads as one vector
+    struct alignas(16) StateVariable
+    {
+        float a1;
+        float a2;
+        float a3;
+    };
+
+    // The designs for one sample rate. Cutoffs are spaced evenly within each
+    // octave, so a cutoff's position in the table comes straight from the
+    // exponent and mantissa of the float, and the designs either side of it
+    // are interpolated
+    class Designs
+    {
+    public:
+        Designs(double sampleRate);
+
+        double getSampleRate() const;
+        Biquad getHighPass(float freq) const;
+        Biquad getLowPass(float freq) const;
+        StateVariable getStateVariable(float freq) const;
+
+    private:
+        double sampleRate;
+        std::vector<Biquad> highPass;
+        std::vector<Biquad> lowPass;
+        std::vector<StateVariable> stateVariable;
+
+        float getPosition(float freq, size_t& index) const;
+        static Biquad interpolate(const Biquad& a, const Biquad& b,
+            float amount);
+    };
+
+    static constexpr float minFreq = 20;
+    static constexpr float maxFreq = 20000;
+    static constexpr int firstOctave = 4; // 16 Hz
+    static constexpr int lastOctave = 14; // 16384 Hz
+    static constexpr size_t pointsPerOctave = 128;
+    static constexpr float stateVariableDamping = 1.41421356f; // 1 / Q
+
+    const Designs& getDesigns(double sampleRate);
+
+    static Biquad designHighPass(double sampleRate, double freq);
+    static Biquad designLowPass(double sampleRate, double freq);
+    static StateVariable designStateVariable(double sampleRate, double freq);
+
+private:
+    juce::CriticalSection lock;
+    std::vector<std::unique_ptr<Designs>> designs;
+};
\ No newline at end of file
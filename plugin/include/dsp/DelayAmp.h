@@ -1,14 +1,16 @@
 #pragma once
-#include <juce_audio_processors/juce_audio_processors.h>
 
-struct DelayAmp : public juce::AudioProcessorValueTreeState::Listener
+// The level of one interval's tap. The value is moved towards the parameter
+// snapshot once per sub-block, by the share of the rest of the host block the
+// sub-block covers, and the last value read is kept so that each sub-block
+// can ramp from where the last one ended.
+struct DelayAmp
 {
 public:
     DelayAmp();
-    ~DelayAmp() override;
 
-    void listenTo(juce::AudioProcessorValueTreeState*, std::string);
-    void parameterChanged(const juce::String&, float) override;
+    void setValue(float target, float fraction);
+    void reset();
 
     float getLastValue();
     float getCurrentValue();
@@ -17,6 +19,4 @@ public:
 private:
     float lastValue;
     float currentValue;
-    juce::AudioProcessorValueTreeState* tree;
-    std::string parameterId;
 };
\ No newline at end of file
@@ -0,0 +1,56 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// Backing store for a circular buffer. Where the platform allows it (Linux,
+// via memfd + mmap) the same physical pages are mapped twice back to back, so
+// any run of up to size() samples starting inside the buffer can be read and
+// written contiguously, with writes past the end landing at the start. When
+// the mapping can't be made, an ordinary heap allocation is used instead and
+// isMirrored() returns false.
+//
+// On Linux the mapping is also made ready for the audio thread when it's
+// allocated: it uses huge pages where the system has some to spare (or asks
+// for transparent ones), its pages are faulted in up front rather than on
+// first use, and it can be locked into memory. Each of these is best effort,
+// and the memory works the same without them.
+class DelayMemory
+{
+public:
+    // Lifecycle
+    DelayMemory();
+    ~DelayMemory();
+    DelayMemory(const DelayMemory&) = delete;
+    DelayMemory& operator=(const DelayMemory&) = delete;
+
+    void allocate(std::size_t numSamples);
+    void release();
+
+    // Locking (applies now, and to anything allocated later)
+    void setLocked(bool shouldLock);
+    bool isLocked();
+
+    // Access
+    float* data();
+    std::size_t size();
+    bool isMirrored();
+    bool usesHugePages();
+
+private:
+    static constexpr std::size_t hugePageSize = 2 << 20;
+
+    float* samples;
+    std::size_t length;
+    bool mirrored;
+    bool hugePages;
+    bool lockRequested;
+    bool locked;
+    std::vector<float> fallback;
+
+    bool allocateMirrored(std::size_t numSamples);
+    bool mapMirrored(std::size_t bytes, bool huge);
+    std::size_t getMappedBytes();
+    void prefault();
+    void lock();
+    void unlock();
+};
\ No newline at end of file
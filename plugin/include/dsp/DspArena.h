@@ -0,0 +1,61 @@
+#pragma once
+#include <type_traits>
+#include <vector>
+#include <juce_core/juce_core.h>
+
+// One allocation holding an instance's working buffers, laid out in the
+// order processing touches them, with each block starting on a cache line.
+//
+// The arena is laid out in two passes over the same calls to allocate.
+// While planning, allocate only records each block's name and size, and
+// returns nullptr. Once the arena has been committed, the same calls, made in
+// the same order, return the memory each block was given. Nothing else is
+// allocated until the arena is planned again.
+class DspArena
+{
+public:
+    static constexpr size_t alignment = 64;
+
+    // Lifecycle
+    DspArena();
+    ~DspArena();
+    DspArena(const DspArena&) = delete;
+    DspArena& operator=(const DspArena&) = delete;
+
+    // Layout
+    void plan();
+    void commit();
+    template <typename T>
+    T* allocate(const juce::String& name, size_t count);
+
+    // Reporting
+    size_t getSize() const;
+    juce::String getMemoryMap() const;
+
+private:
+    struct Block
+    {
+        juce::String name;
+        size_t offset;
+        size_t bytes;
+    };
+
+    std::vector<Block> blocks;
+    unsigned char* memory;
+    size_t size;
+    size_t nextBlock;
+    bool planning;
+
+    void* allocateBytes(const juce::String& name, size_t bytes);
+    void release();
+};
+
+template <typename T>
+T* DspArena::allocate(const juce::String& name, size_t count)
+{
+    // the memory is zeroed rather than constructed, and never destroyed
+    static_assert(std::is_trivially_copyable_v<T>);
+    static_assert(std::is_trivially_destructible_v<T>);
+    static_assert(alignof(T) <= alignment);
+    return static_cast<T*>(allocateBytes(name, count * sizeof(T)));
+}
\ No newline at end of file
@@ -1,46 +1,111 @@
 #pragma once
-#include <juce_audio_processors/juce_audio_processors.h>
-#include <juce_dsp/juce_dsp.h>
+#include "CoefficientBank.h"
 
-class Filter : public juce::AudioProcessorValueTreeState::Listener
+// One interval's high-pass and low-pass filters. The coefficients are shared
+// by every interval on a side and come from a CoefficientBank, so a Filter
+// only holds the state that belongs to its own tap.
+//
+// When the delay line is read-only, a tap has to filter its samples as many
+// times as there are intervals before it, so a Filter also holds the state
+// for a cascade of up to maxCascadeStages such filters.
+class Filter
 {
 public:
+    static constexpr size_t maxCascadeStages = 16;
+
+    // A tap processed in lock step with others by processTaps: its window of
+    // interleaved (L, R) frames, the filter for each channel, and each
+    // channel's amp ramp
+    struct InterleavedTap
+    {
+        float* frames;
+        Filter* left;
+        Filter* right;
+        float leftAmp;
+        float leftAmpStep;
+        float rightAmp;
+        float rightAmpStep;
+    };
+
     // Lifecycle
     Filter();
-    Filter(double sampleRate, float low, float high);
-    ~Filter();
-
-    // Parameters
-    void attachToParameters(juce::AudioProcessorValueTreeState* treeState,
-        const std::string& highPass, const std::string& lowPass,
-        const std::string& mix);
-    void parameterChanged(const juce::String&, float);
 
     // Process Audio
     void reset();
-    void prepare(const juce::dsp::ProcessSpec&);
-    float processSample(float sample);
-    void processSamples(float* samples, size_t length);
+    void processTap(const CoefficientBank& coefficients, float* samples,
+        size_t length, size_t stride, size_t offset, float gain,
+        float gainStep, float* output, float amp, float ampStep,
+        bool inPlace = true);
+    static void processTaps(const CoefficientBank& leftCoefficients,
+        const CoefficientBank& rightCoefficients, InterleavedTap* taps,
+        size_t numTaps, size_t length, float gain, float gainStep,
+        float* leftOutput, float* rightOutput);
+    void processCascade(const CoefficientBank& coefficients,
+        const float* samples, size_t length, size_t stride, size_t offset,
+        size_t numStages, float gain, float gainStep, float* output,
+        float amp, float ampStep);
+
+    // Debugging
+    size_t countSubnormals() const;
 
 private:
-    juce::dsp::IIR::Filter<float> highPass;
-    juce::dsp::IIR::Filter<float> lowPass;
+    // transposed direct form II state, as used by juce::dsp::IIR::Filter,
+    // or the two integrator states of a state variable filter
+    struct State
+    {
+        float s1;
+        float s2;
+    };
 
-    juce::SmoothedValue<float> highPassFreq;
-    juce::SmoothedValue<float> lowPassFreq;
-    juce::SmoothedValue<float> smoothMix;
-    static constexpr size_t smoothGrain = 10;
+    // the dry/wet mix for a run of samples, with a stride of zero when it
+    // isn't moving. When fully wet no dry signal is mixed in at all
+    struct Mix
+    {
+        const float* values;
+        size_t stride;
+        bool fullyWet;
+    };
 
-    juce::AudioProcessorValueTreeState* tree;
-    std::string highPassParam;
-    std::string lowPassParam;
-    std::string mixParam;
+    struct Stage
+    {
+        State highPass;
+        State lowPass;
+    };
 
-    double lastSampleRate;
-    std::vector<float> tempBuffer;
+    State highPass;
+    State lowPass;
+    Stage stages[maxCascadeStages];
 
     // Helper Functions
-    void setHighPassFrequency(float freq);
-    void setLowPassFrequency(float freq);
+    void snapStatesToZero(size_t numStages);
+    static void snapToZero(State& state);
+    static Mix getMix(const CoefficientBank& coefficients, size_t offset);
+    static float applyMix(const Mix& mix, size_t i, float wet, float dry);
+    static float filterSample(const CoefficientBank::Biquad& highPass,
+        const CoefficientBank::Biquad& lowPass, State& high, State& low,
+        float sample);
+    static float filterSample(const CoefficientBank::StateVariable& highPass,
+        const CoefficientBank::StateVariable& lowPass, State& high,
+        State& low, float sample);
+    void processTapRange(const CoefficientBank::Biquad& highPassCoefficients,
+        const CoefficientBank::Biquad& lowPassCoefficients, Mix mix,
+        float* samples, size_t length, size_t stride, float& gain,
+        float gainStep, float* output, float& amp, float ampStep,
+        bool inPlace);
+    void processStateVariableRange(const CoefficientBank& coefficients,
+        float* samples, size_t length, size_t stride, size_t offset,
+        float& gain, float gainStep, float* output, float& amp,
+        float ampStep, bool inPlace);
+    template <typename Coefficients>
+    void processCascadeRange(const Coefficients* highPassCoefficients,
+        const Coefficients* lowPassCoefficients, size_t coefficientStride,
+        Mix mix, const float* samples, size_t length, size_t stride,
+        size_t numStages, float& gain, float gainStep, float* output,
+        float& amp, float ampStep);
+    template <FilterEngine engine, size_t numRegisters>
+    static void processTapLanes(const CoefficientBank& leftCoefficients,
+        const CoefficientBank& rightCoefficients, InterleavedTap* taps,
+        size_t length, float gain, float gainStep, float* leftOutput,
+        float* rightOutput);
 
 };
\ No newline at end of file
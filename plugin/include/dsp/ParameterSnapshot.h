@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// The value of every parameter the audio thread reads, taken once per block.
+// Each parameter is looked up by its ID once, when it's attached, and from
+// then on reading it is a single atomic load, so the audio thread never
+// compares strings or shares a plain float with a listener on another
+// thread. A bit is set for every parameter whose value changed since the
+// last snapshot, so work that depends on a parameter can be skipped until
+// it moves.
+class ParameterSnapshot
+{
+public:
+    typedef uint64_t Mask;
+
+    static constexpr size_t numAmps = 16;
+    static constexpr size_t numFilterParameters = 3;
+
+    // each side's filter parameters are in the order high pass, low pass,
+    // mix, and each side's amps are in the order of their intervals
+    enum Parameter
+    {
+        delayTime,
+        delayTimeSync,
+        tempoSync,
+        numIntervals,
+        loop,
+        delaysLinked,
+        filtersLinked,
+        wet,
+        falloff,
+        leftHighPass,
+        leftLowPass,
+        leftFilterMix,
+        rightHighPass,
+        rightLowPass,
+        rightFilterMix,
+        leftAmp,
+        rightAmp = leftAmp + numAmps,
+        numParameters = rightAmp + numAmps
+    };
+
+    static_assert(numParameters <= sizeof(Mask) * 8);
+
+    // Lifecycle
+    ParameterSnapshot();
+
+    // Attaching
+    void attach(size_t parameter, const std::atomic<float>* value);
+
+    // Per Block
+    void update();
+    void markAllChanged();
+
+    // Reading
+    float get(size_t parameter) const;
+    bool hasChanged(Mask parameters) const;
+    static Mask getMask(size_t parameter, size_t count = 1);
+
+private:
+    const std::atomic<float>* sources[numParameters];
+    float values[numParameters];
+    Mask changed;
+};
\ No newline at end of file
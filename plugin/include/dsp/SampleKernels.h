@@ -0,0 +1,81 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Gain and ramp kernels for contiguous runs of samples. Ramps are evaluated
+// from the sample index, so the gain applied to sample i of a run is
+// startGain + gainStep * (offset + i + 1). Passing the number of samples
+// already processed as the offset lets a ramp that is split across the wrap
+// point of a circular buffer continue exactly where it left off.
+namespace SampleKernels
+{
+
+// A run of samples summed into the output of mixRamped, with its own ramp
+struct RampedInput
+{
+    const float* samples;
+    float startGain;
+    float gainStep;
+};
+
+void mixRamped(float* output, size_t length, float startGain, float gainStep,
+    const RampedInput* inputs, size_t numInputs);
+
+// Samples no further from zero than snapThreshold (about -160 dB, the same
+// threshold as JUCE's snapToZero) are set to zero, so that a decaying signal
+// reaches silence instead of lingering in the subnormal range
+constexpr float snapThreshold = 1.0e-8f;
+void snapToZero(float* samples, size_t length);
+// for debug builds to check that nothing subnormal is left behind
+size_t countSubnormals(const float* samples, size_t length);
+
+// Kernels for stereo frames stored interleaved (L, R, L, R, ...). Ramps
+// advance once per frame, so both samples of a frame get the same gain.
+void interleave(float* frames, const float* left, const float* right,
+    size_t numFrames);
+void interleaveWithAddRamped(float* frames, const float* left,
+    const float* right, const float* addLeft, const float* addRight,
+    size_t numFrames, float startGain, float gainStep, size_t offset = 0);
+
+// Kernels that pack samples into the 16-bit formats a delay line can be
+// stored in, and unpack them again. Half precision keeps float's range with
+// an 11-bit mantissa, rounding to nearest even. The 16-bit integers cover
+// -int16Range to int16Range (12 dB of headroom above full scale), with
+// triangular dither added before rounding so that the error is noise rather
+// than distortion; each of the four lanes of the dither has its own state.
+// Samples under half a step get no dither and round to zero, so silence is
+// stored as silence rather than as noise the taps would keep requantising.
+constexpr float int16Range = 4.0f;
+struct DitherState
+{
+    uint32_t lanes[4] = { 0x9e3779b9, 0x7f4a7c15, 0x85ebca6b, 0xc2b2ae35 };
+};
+void floatToHalf(uint16_t* packed, const float* samples, size_t length);
+void halfToFloat(float* samples, const uint16_t* packed, size_t length);
+void floatToInt16Dithered(uint16_t* packed, const float* samples,
+    size_t length, DitherState& dither);
+void int16ToFloat(float* samples, const uint16_t* packed, size_t length);
+
+// Scalar reference implementations. These are used on platforms without SSE
+// and for the tail of each run that doesn't fill a whole vector. The inputs
+// to mixRampedScalar are read from offset onwards, since they can't be moved
+// along with the output pointer.
+void mixRampedScalar(float* output, size_t length, float startGain,
+    float gainStep, const RampedInput* inputs, size_t numInputs,
+    size_t offset = 0);
+void snapToZeroScalar(float* samples, size_t length);
+void interleaveScalar(float* frames, const float* left, const float* right,
+    size_t numFrames);
+void interleaveWithAddRampedScalar(float* frames, const float* left,
+    const float* right, const float* addLeft, const float* addRight,
+    size_t numFrames, float startGain, float gainStep, size_t offset = 0);
+void floatToHalfScalar(uint16_t* packed, const float* samples,
+    size_t length);
+void halfToFloatScalar(float* samples, const uint16_t* packed,
+    size_t length);
+void floatToInt16DitheredScalar(uint16_t* packed, const float* samples,
+    size_t length, DitherState& dither);
+void int16ToFloatScalar(float* samples, const uint16_t* packed,
+    size_t length);
+
+}
\ No newline at end of file
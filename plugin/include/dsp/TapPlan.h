@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// The taps that have to run for a block, in the order they run in. It is
+// worked out from which taps can be heard (their amp is above zero at either
+// end of the block's ramp) and only rebuilt when that, the number of
+// intervals or the history mode changes.
+//
+// In place, every tap writes its falloff and filtering back into the delay
+// line, and the taps after it (and the loop head) hear that. A tap that's
+// silent now may be turned up later, and it has to hear history that every
+// tap before it has processed, so every tap runs. Read only, each tap
+// stands alone, so only the taps that are heard run.
+class TapPlan
+{
+public:
+    static constexpr size_t maxTaps = 16;
+
+    // Lifecycle
+    TapPlan();
+
+    // Building
+    void update(uint32_t audibleTaps, size_t numIntervals, bool inPlace);
+
+    // Reading
+    size_t getNumTaps() const;
+    size_t getInterval(size_t index) const;
+
+private:
+    size_t intervals[maxTaps];
+    size_t numTaps;
+
+    uint32_t lastAudibleTaps;
+    size_t lastNumIntervals;
+    bool lastInPlace;
+    bool built;
+};
\ No newline at end of file
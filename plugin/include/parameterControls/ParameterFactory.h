@@ -26,9 +26,22 @@ std::unique_ptr<juce::AudioParameterFloat> createTimeParameter(std::string id,
 std::unique_ptr<juce::AudioParameterFloat> createTimeParameter(std::string id,
     std::string name, float min, float max, float step, float defaultVal);
 
+std::unique_ptr<juce::AudioParameterFloat> createTimeParameter(std::string id,
+    std::string name, juce::NormalisableRange<float> range, float defaultVal);
+
+std::unique_ptr<juce::AudioParameterFloat> createSkewedTimeParameter
+    (std::string id, std::string name, float min, float max, float step,
+    float centre, float defaultVal);
+
 std::unique_ptr<juce::AudioParameterChoice> createChoiceParameter
     (std::string id, std::string name, juce::StringArray&, int defaultIdx);
 
+// a choice of how the plugin runs rather than of how it sounds, which hosts
+// don't offer for automation
+std::unique_ptr<juce::AudioParameterChoice> createOptionParameter
+    (std::string id, std::string name, juce::StringArray options,
+    int defaultIndex);
+
 std::unique_ptr<juce::AudioParameterChoice> createIntChoiceParameter
     (std::string id, std::string name, juce::Array<int> options,
     int defaultIndex);
@@ -53,6 +53,14 @@ PluginEditor::PluginEditor(PluginProcessor& p)
     setupChannelFilters();
     setupChannelButtons();
     setupRightSideGlobals();
+
+#if JUCE_DEBUG
+    // debug builds show how many subnormals the last block ran into, which
+    // should stay at zero while the loop decays
+    subnormalLabel.setFont(juce::FontOptions(11));
+    subnormalLabel.setJustificationType(juce::Justification::centred);
+    addAndMakeVisible(subnormalLabel);
+#endif
     
     startTimer(100);
     
@@ -315,6 +323,10 @@ void PluginEditor::resized()
     layoutChannelFilters();
     layoutChannelButtons();
     layoutRightSideGlobals();
+
+#if JUCE_DEBUG
+    subnormalLabel.setBounds(0, getHeight() - 14, col1Width, 14);
+#endif
 }
 
 void PluginEditor::parameterChanged(const juce::String& param, float value)
@@ -353,6 +365,12 @@ void PluginEditor::handleAsyncUpdate()
 void PluginEditor::timerCallback()
 {
     setNoteValueDelayLabel();
+
+#if JUCE_DEBUG
+    juce::String subnormals(processorRef.getSubnormalCount());
+    subnormalLabel.setText(subnormals + " subnormals",
+        juce::dontSendNotification);
+#endif
 }
 
 void PluginEditor::layoutLeftSideGlobals()
@@ -715,11 +733,17 @@ void PluginEditor::setNoteValueDelayLabel()
     {
         s = "";
     }
-    else if (milliseconds <= 250)
+    else if (milliseconds < 1000)
     {
         s = std::to_string(milliseconds) + "ms"; 
         c = normalTextColor;
     }
+    else if (static_cast<float>(milliseconds)
+        <= processorRef.getMaxDelayTime())
+    {
+        s = juce::String(seconds, 2).toStdString() + "s";
+        c = normalTextColor;
+    }
     else
     {
         s = "Too Long";
@@ -3,8 +3,19 @@
 #include <juce_dsp/juce_dsp.h>
 #include "PluginEditor.h"
 #include "ParameterFactory.h"
+#include "SampleKernels.h"
 
-const float PluginProcessor::maxDelayTime = 250;
+const float PluginProcessor::maxDelayTime = 4000;
+const int PluginProcessor::crossfadeTimes[numCrossfadeTimes] = {
+	10, 25, 50, 100, 200
+};
+
+const PluginProcessor::LinkRoute PluginProcessor::linkRoutes[numLinkRoutes] = {
+	{ ParameterSnapshot::rightAmp, ParameterSnapshot::rightHighPass },
+	{ ParameterSnapshot::leftAmp, ParameterSnapshot::rightHighPass },
+	{ ParameterSnapshot::rightAmp, ParameterSnapshot::leftHighPass },
+	{ ParameterSnapshot::leftAmp, ParameterSnapshot::leftHighPass }
+};
 
 const NoteValue PluginProcessor::noteValues[numNoteValues] = {
 	{ "16th triplet", 0.0417f },
@@ -18,20 +29,35 @@ const NoteValue PluginProcessor::noteValues[numNoteValues] = {
 PluginProcessor::PluginProcessor() :
 	AudioProcessor(createBusesProperties()),
 	tree(*this, nullptr, "PARAMETERS", createParameters()),
+	settings("SETTINGS"),
 	lastSampleRate(44100),
-	lastBpm(-1)
+	lastBpm(-1),
+	tailLength(0),
+	blockFraction(1),
+	crossfadeTime(static_cast<float>(crossfadeTimes[defaultCrossfadeTime])),
+	activeRightCoefficients(&rightCoefficients),
+	rightCoefficientsShared(false),
+	activeFilterSet(0),
+	activeLoopFilterSet(0),
+	requestedFilterEngine(FilterEngine::biquad),
+	historyMode(HistoryMode::inPlace),
+	requestedHistoryMode(HistoryMode::inPlace),
+	requestedDelayStorage(DelayStorage::float32),
+	lockDelayMemory(false),
+	activeLinkRoute(0),
+	fadingLinkRoute(0),
+	linkFadePositions{ 0, 0 },
+	lastBlockSubnormals(0),
+	tempChannels{ nullptr, nullptr, nullptr, nullptr }
 {
-	for (int i = 0;i < maxIntervals;i++)
-	{
-		leftAmps[i].listenTo(&tree, getIdForLeftIntervalAmp(i));
-		rightAmps[i].listenTo(&tree, getIdForRightIntervalAmp(i));
-
-		leftFilters[i].attachToParameters(&tree, "left-high-pass",
-			"left-low-pass", "left-filter-mix");
-		rightFilters[i].attachToParameters(&tree, "right-high-pass",
-			"right-low-pass", "right-filter-mix");
-	}
-
+	attachParameters();
+	tree.addParameterListener("filter-engine", this);
+	tree.addParameterListener("history-mode", this);
+	tree.addParameterListener("delay-storage", this);
+	tree.addParameterListener("crossfade-time", this);
+	settings.addListener(this);
+	resetParameterTargets();
+	updateCrossfadeLength();
 	updateParametersOnReset();
 
 #if PERFETTO
@@ -41,6 +67,11 @@ PluginProcessor::PluginProcessor() :
 
 PluginProcessor::~PluginProcessor()
 {
+	tree.removeParameterListener("filter-engine", this);
+	tree.removeParameterListener("history-mode", this);
+	tree.removeParameterListener("delay-storage", this);
+	tree.removeParameterListener("crossfade-time", this);
+	settings.removeListener(this);
 #if PERFETTO
     MelatoninPerfetto::get().endSession();
 #endif
@@ -51,8 +82,10 @@ PluginProcessor::createParameters()
 {
 	juce::AudioProcessorValueTreeState::ParameterLayout parameters;
 
-	parameters.add(ParameterFactory::createTimeParameter("delay-time",
-		"Delay Time", 20, maxDelayTime, 1, 100));
+	// delay times span a couple of orders of magnitude, so the knob's centre
+	// is at their geometric middle rather than halfway between them
+	parameters.add(ParameterFactory::createSkewedTimeParameter("delay-time",
+		"Delay Time", 20, maxDelayTime, 1, std::sqrt(20 * maxDelayTime), 100));
 	
 	juce::StringArray noteOptions;
 	for (size_t i = 0;i < numNoteValues;i++)
@@ -123,6 +156,22 @@ PluginProcessor::createParameters()
 			getIdForRightIntervalAmp(i), rightName, rDefault
 		));
 	}
+
+	// engine options, which are saved with the state but aren't automated
+	parameters.add(ParameterFactory::createOptionParameter("filter-engine",
+		"Filter Engine", { "Biquad", "State Variable" }, 0));
+	parameters.add(ParameterFactory::createOptionParameter("history-mode",
+		"History Mode", { "In Place", "Read Only" }, 0));
+	parameters.add(ParameterFactory::createOptionParameter("delay-storage",
+		"Delay Storage", { "Float", "Half Float", "Dithered 16-bit" }, 0));
+
+	juce::StringArray crossfadeOptions;
+	for (size_t i = 0;i < numCrossfadeTimes;i++)
+	{
+		crossfadeOptions.add(juce::String(crossfadeTimes[i]) + " ms");
+	}
+	parameters.add(ParameterFactory::createOptionParameter("crossfade-time",
+		"Crossfade Time", crossfadeOptions, defaultCrossfadeTime));
 	
 	return parameters;
 }
@@ -163,7 +212,9 @@ bool PluginProcessor::isBusesLayoutSupported(const BusesLayout &layouts) const
 
 double PluginProcessor::getTailLengthSeconds() const
 {
-	return maxIntervals * maxDelayTime / 1000;
+	// hosts may ask from any thread, so it's kept up to date by the audio
+	// thread whenever the delay or the number of intervals changes
+	return tailLength.load();
 }
 
 float PluginProcessor::getSecondsForNoteValue(int index)
@@ -175,28 +226,68 @@ float PluginProcessor::getSecondsForNoteValue(int index)
 	return (noteValues[index].proportion / static_cast<float>(lastBpm)) * 240;
 }
 
+float PluginProcessor::getMaxDelayTime() const
+{
+	return maxDelayTime;
+}
+
 void PluginProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
 {
+	// the filters are prepared at their parameters' values, and the amps
+	// don't ramp in from where playback last stopped
+	resetParameterTargets();
+
+	// every block is processed in sub-blocks, so nothing needs room for more
+	// than one of them (and hosts that send more than samplesPerBlock are
+	// handled the same way)
+	size_t subBlockSize = juce::jlimit((size_t) 1, maxSubBlockSize,
+		static_cast<size_t>(samplesPerBlock));
 	juce::dsp::ProcessSpec spec;
 	spec.sampleRate = sampleRate;
-	spec.maximumBlockSize = static_cast<unsigned>(samplesPerBlock);
+	spec.maximumBlockSize = static_cast<unsigned>(subBlockSize);
 	spec.numChannels = static_cast<unsigned>(getTotalNumOutputChannels());
-	for (int i = 0;i < maxIntervals;i++)
-	{
-		leftFilters[i].prepare(spec);
-		rightFilters[i].prepare(spec);
-	}
-
-	leftBuffer.resize(sampleRate, (maxDelayTime / 1000) * (maxIntervals + 1));
-	rightBuffer.resize(sampleRate, (maxDelayTime / 1000) * (maxIntervals + 1));
-	tempBuffer.resize((size_t) samplesPerBlock, 0.0f);
+	leftCoefficients.prepare(spec, samplesPerBlock);
+	rightCoefficients.prepare(spec, samplesPerBlock);
+	resetFilters();
 		
 	lastSampleRate = sampleRate;
+	updateCrossfadeLength();
+	updateParametersOnReset();
+	prepareDelayLine(subBlockSize);
+}
 
-	lastAmpsLinked = *tree.getRawParameterValue("delays-linked") >= 1;
-	lastFiltersLinked = *tree.getRawParameterValue("filters-linked") >= 1;
+void PluginProcessor::prepareDelayLine(size_t subBlockSize)
+{
+	// the delay line only needs to be as long as the current delays, and
+	// grows in the background if they're lengthened while playing
+	delayLine.setLocked(lockDelayMemory);
+	delayLine.prepare(getDelayLineLength(activeDelay, activeNumIntervals),
+		subBlockSize, requestedDelayStorage);
+
+	// every block is asked for twice: once to lay the arena out, and again
+	// to hand out the memory once it has been allocated
+	arena.plan();
+	allocateArenaBlocks(subBlockSize);
+	arena.commit();
+	allocateArenaBlocks(subBlockSize);
+
+	// channels 0 and 1 hold the wet signal, while 2 and 3 hold the looped
+	// signal. Only now do they point at memory, so the buffer is only set up
+	// after the arena has been committed
+	tempBuffer.setDataToReferTo(tempChannels, numTempChannels,
+		static_cast<int>(subBlockSize));
+}
 
-	updateParametersOnReset();
+void PluginProcessor::allocateArenaBlocks(size_t subBlockSize)
+{
+	// in the order each sub-block uses them
+	leftCoefficients.allocate(arena, "left");
+	rightCoefficients.allocate(arena, "right");
+	tempChannels[2] = arena.allocate<float>("looped left", subBlockSize);
+	tempChannels[3] = arena.allocate<float>("looped right", subBlockSize);
+	delayLine.allocate(arena);
+	tempChannels[0] = arena.allocate<float>("wet left", subBlockSize);
+	tempChannels[1] = arena.allocate<float>("wet right", subBlockSize);
 }
 
 void PluginProcessor::releaseResources() { }
@@ -207,6 +298,11 @@ void PluginProcessor::processBlock
 	TRACE_DSP();
 	juce::ignoreUnused(midiMessages); // not a midi plugin
 
+	// the filter states and the looped signal decay towards zero whenever
+	// the input goes quiet, and subnormal arithmetic is far slower on most
+	// CPUs, so they're flushed to zero for the whole block
+	juce::ScopedNoDenormals noDenormals;
+
 	int numInputChannels = getTotalNumInputChannels();
 	int numOutputChannels = getTotalNumOutputChannels();
 	for (int i = numInputChannels;i < numOutputChannels;i++)
@@ -214,18 +310,73 @@ void PluginProcessor::processBlock
 		buffer.clear(i, 0, buffer.getNumSamples());
 	}
 	
-	numSamples = static_cast<size_t>(buffer.getNumSamples());	
-	
 	handleTempoSync();
+	snapshot.update();
 	handleParameterLinking();
-	updateCurrentBlockParameters();
 
+	// each sub-block runs the whole pipeline as if it were a block of its
+	// own, so every ramp carries on from where the last sub-block left it.
+	// Each takes its share of what's left of the host block's ramps, so a
+	// parameter still glides over the whole host block as it did unsplit
 	float* leftAudio = buffer.getWritePointer(0);
-	processChannel(leftAudio, &leftBuffer, leftAmps, leftFilters);
 	float* rightAudio = buffer.getWritePointer(1);
-	processChannel(rightAudio, &rightBuffer, rightAmps, rightFilters);
-	
-	updateLastBlockParameters();
+	size_t subBlockSize = static_cast<size_t>(tempBuffer.getNumSamples());
+	size_t blockSize = static_cast<size_t>(buffer.getNumSamples());
+	size_t subnormals = 0;
+	for (size_t start = 0;start < blockSize;start += subBlockSize)
+	{
+		numSamples = juce::jmin(subBlockSize, blockSize - start);
+		blockFraction = static_cast<float>(numSamples)
+			/ static_cast<float>(blockSize - start);
+
+		updateParameterTargets();
+		updateCurrentBlockParameters();
+		updateHistoryMode();
+		updateCrossfade();
+		updateFilterCoefficients();
+
+		processChannels(leftAudio + start, rightAudio + start);
+#if JUCE_DEBUG
+		subnormals += countSubnormals(leftAudio + start, rightAudio + start);
+#endif
+
+		updateLastBlockParameters();
+	}
+	lastBlockSubnormals = subnormals;
+}
+
+size_t PluginProcessor::getSubnormalCount() const
+{
+	return lastBlockSubnormals;
+}
+
+juce::String PluginProcessor::getArenaMemoryMap() const
+{
+	return arena.getMemoryMap();
+}
+
+size_t PluginProcessor::countSubnormals(const float* left,
+	const float* right)
+{
+	size_t count = SampleKernels::countSubnormals(left, numSamples)
+		+ SampleKernels::countSubnormals(right, numSamples);
+	if (loop || lastBlockLoop)
+	{
+		count += SampleKernels::countSubnormals(tempBuffer.getReadPointer(2),
+			numSamples);
+		count += SampleKernels::countSubnormals(tempBuffer.getReadPointer(3),
+			numSamples);
+	}
+
+	for (size_t set = 0;set < numFilterSets;set++)
+	{
+		for (size_t i = 0;i < maxIntervals;i++)
+		{
+			count += leftFilters[set][i].countSubnormals();
+			count += rightFilters[set][i].countSubnormals();
+		}
+	}
+	return count;
 }
 
 void PluginProcessor::handleTempoSync()
@@ -239,27 +390,201 @@ void PluginProcessor::handleTempoSync()
 
 void PluginProcessor::handleParameterLinking()
 {
-	bool ampsLinked = *tree.getRawParameterValue("delays-linked") >= 1;
-	if (ampsLinked && !lastAmpsLinked)
+	// while linked, the right side follows the left side's parameters. The
+	// route for every combination of links is worked out ahead of time, so a
+	// change of link only has to pick another one
+	size_t route = 0;
+	if (snapshot.get(ParameterSnapshot::delaysLinked) >= 1)
 	{
-		linkDelays();
+		route |= getLinkBit(delaysLink);
 	}
-	else if (!ampsLinked && lastAmpsLinked)
+	if (snapshot.get(ParameterSnapshot::filtersLinked) >= 1)
 	{
-		unlinkDelays();
+		route |= getLinkBit(filtersLink);
 	}
-	lastAmpsLinked = ampsLinked;
 
-	bool filtersLinked = *tree.getRawParameterValue("filters-linked") >= 1;
-	if (filtersLinked && !lastFiltersLinked)
+	if (route == activeLinkRoute)
 	{
-		linkFilters();
+		return;
 	}
-	else if (!filtersLinked && lastFiltersLinked)
+
+	// each link fades on its own, so one changing doesn't disturb a fade
+	// the other is in the middle of
+	for (size_t link = 0;link < numLinks;link++)
 	{
-		unlinkFilters();
+		size_t bit = getLinkBit(link);
+		if (((route ^ activeLinkRoute) & bit) == 0)
+		{
+			continue;
+		}
+
+		size_t& position = linkFadePositions[link];
+		if (((fadingLinkRoute ^ activeLinkRoute) & bit) != 0)
+		{
+			// switched straight back, so the fade turns around where it is
+			position = crossfadeLength - juce::jmin(position, crossfadeLength);
+		}
+		else
+		{
+			position = 0;
+		}
+		fadingLinkRoute = (fadingLinkRoute & ~bit) | (activeLinkRoute & bit);
 	}
-	lastFiltersLinked = filtersLinked;
+	activeLinkRoute = route;
+	rightCoefficientsShared = false;
+}
+
+void PluginProcessor::attachParameters()
+{
+	// the only place the parameters are looked up by ID; from here on they
+	// are read through the snapshot
+	snapshot.attach(ParameterSnapshot::delayTime,
+		tree.getRawParameterValue("delay-time"));
+	snapshot.attach(ParameterSnapshot::delayTimeSync,
+		tree.getRawParameterValue("delay-time-sync"));
+	snapshot.attach(ParameterSnapshot::tempoSync,
+		tree.getRawParameterValue("tempo-sync"));
+	snapshot.attach(ParameterSnapshot::numIntervals,
+		tree.getRawParameterValue("num-intervals"));
+	snapshot.attach(ParameterSnapshot::loop,
+		tree.getRawParameterValue("loop"));
+	snapshot.attach(ParameterSnapshot::delaysLinked,
+		tree.getRawParameterValue("delays-linked"));
+	snapshot.attach(ParameterSnapshot::filtersLinked,
+		tree.getRawParameterValue("filters-linked"));
+	snapshot.attach(ParameterSnapshot::wet,
+		tree.getRawParameterValue("wet"));
+	snapshot.attach(ParameterSnapshot::falloff,
+		tree.getRawParameterValue("falloff"));
+
+	snapshot.attach(ParameterSnapshot::leftHighPass,
+		tree.getRawParameterValue("left-high-pass"));
+	snapshot.attach(ParameterSnapshot::leftLowPass,
+		tree.getRawParameterValue("left-low-pass"));
+	snapshot.attach(ParameterSnapshot::leftFilterMix,
+		tree.getRawParameterValue("left-filter-mix"));
+	snapshot.attach(ParameterSnapshot::rightHighPass,
+		tree.getRawParameterValue("right-high-pass"));
+	snapshot.attach(ParameterSnapshot::rightLowPass,
+		tree.getRawParameterValue("right-low-pass"));
+	snapshot.attach(ParameterSnapshot::rightFilterMix,
+		tree.getRawParameterValue("right-filter-mix"));
+
+	for (int i = 0;i < maxIntervals;i++)
+	{
+		size_t index = static_cast<size_t>(i);
+		snapshot.attach(ParameterSnapshot::leftAmp + index,
+			tree.getRawParameterValue(getIdForLeftIntervalAmp(i)));
+		snapshot.attach(ParameterSnapshot::rightAmp + index,
+			tree.getRawParameterValue(getIdForRightIntervalAmp(i)));
+	}
+}
+
+void PluginProcessor::resetParameterTargets()
+{
+	snapshot.update();
+	snapshot.markAllChanged();
+	handleParameterLinking();
+	fadingLinkRoute = activeLinkRoute;
+	rightCoefficientsShared = false;
+	updateParameterTargets();
+
+	for (size_t i = 0;i < maxIntervals;i++)
+	{
+		leftAmps[i].reset();
+		rightAmps[i].reset();
+	}
+}
+
+void PluginProcessor::updateParameterTargets()
+{
+	// after a change of link, the right side fades from the parameters it
+	// followed to those it follows now over the length of a crossfade, so
+	// that the amps and cutoffs glide rather than jump
+	bool ampsFading = isLinkFading(delaysLink);
+	float ampsFade = advanceLinkFade(delaysLink);
+	bool filtersFading = isLinkFading(filtersLink);
+	float filtersFade = advanceLinkFade(filtersLink);
+	const LinkRoute& from = linkRoutes[fadingLinkRoute];
+	const LinkRoute& to = linkRoutes[activeLinkRoute];
+
+	ParameterSnapshot::Mask amps = ParameterSnapshot::getMask(
+		ParameterSnapshot::leftAmp, 2 * ParameterSnapshot::numAmps);
+	if (ampsFading || snapshot.hasChanged(amps))
+	{
+		for (size_t i = 0;i < maxIntervals;i++)
+		{
+			leftAmps[i].setValue(snapshot.get(ParameterSnapshot::leftAmp + i),
+				blockFraction);
+			rightAmps[i].setValue(getRoutedValue(from.rightAmps + i,
+				to.rightAmps + i, ampsFade), blockFraction);
+		}
+	}
+
+	// each side's filter parameters are high pass, low pass, then mix
+	size_t size = ParameterSnapshot::numFilterParameters;
+	size_t left = ParameterSnapshot::leftHighPass;
+	if (snapshot.hasChanged(ParameterSnapshot::getMask(left, size)))
+	{
+		leftCoefficients.setParameters(snapshot.get(left),
+			snapshot.get(left + 1), snapshot.get(left + 2));
+	}
+	size_t right = to.rightFilters;
+	if (filtersFading
+		|| snapshot.hasChanged(ParameterSnapshot::getMask(right, size)))
+	{
+		size_t start = from.rightFilters;
+		rightCoefficients.setParameters(
+			getRoutedValue(start, right, filtersFade),
+			getRoutedValue(start + 1, right + 1, filtersFade),
+			getRoutedValue(start + 2, right + 2, filtersFade));
+	}
+
+	finishLinkFade(delaysLink);
+	finishLinkFade(filtersLink);
+}
+
+size_t PluginProcessor::getLinkBit(size_t link)
+{
+	return (size_t) 1 << link;
+}
+
+bool PluginProcessor::isLinkFading(size_t link)
+{
+	return ((fadingLinkRoute ^ activeLinkRoute) & getLinkBit(link)) != 0;
+}
+
+float PluginProcessor::advanceLinkFade(size_t link)
+{
+	if (!isLinkFading(link))
+	{
+		return 1;
+	}
+
+	size_t& position = linkFadePositions[link];
+	position = juce::jmin(position + numSamples, crossfadeLength);
+	return static_cast<float>(position) / static_cast<float>(crossfadeLength);
+}
+
+void PluginProcessor::finishLinkFade(size_t link)
+{
+	if (isLinkFading(link) && linkFadePositions[link] >= crossfadeLength)
+	{
+		size_t bit = getLinkBit(link);
+		fadingLinkRoute = (fadingLinkRoute & ~bit) | (activeLinkRoute & bit);
+	}
+}
+
+float PluginProcessor::getRoutedValue(size_t from, size_t to, float fade)
+{
+	float target = snapshot.get(to);
+	if (from == to || fade >= 1)
+	{
+		return target;
+	}
+
+	float start = snapshot.get(from);
+	return start + (target - start) * fade;
 }
 
 void PluginProcessor::updateCurrentBlockParameters()
@@ -267,20 +592,26 @@ void PluginProcessor::updateCurrentBlockParameters()
 	currentDelay = getDelaySamples();
 	currentNumIntervals = getCurrentNumIntervals();
 
-	bool delayChanged = currentDelay != lastBlockDelay;
-	bool intervalsChanged = currentNumIntervals != lastBlockNumIntervals;
-	fadeOut = delayChanged || intervalsChanged;
+	currentWet = getRampedValue(lastBlockWet,
+		snapshot.get(ParameterSnapshot::wet) / 100);
+	currentFalloff = getRampedValue(lastBlockFalloff,
+		1 - (snapshot.get(ParameterSnapshot::falloff) / 100));
+	loop = snapshot.get(ParameterSnapshot::loop) >= 1;
+}
+
+float PluginProcessor::getRampedValue(float last, float target)
+{
+	// the last sub-block of a host block lands on the target exactly
+	if (blockFraction >= 1)
+	{
+		return target;
+	}
 
-	currentWet = *tree.getRawParameterValue("wet") / 100;
-	currentFalloff = 1 - (*tree.getRawParameterValue("falloff") / 100);
-	loop = *tree.getRawParameterValue("loop") >= 1;
+	return last + (target - last) * blockFraction;
 }
 
 void PluginProcessor::updateLastBlockParameters()
 {
-	lastBlockDelay = currentDelay;
-	lastBlockNumIntervals = currentNumIntervals;
-	lastBlockFadeOut = fadeOut;
 	lastBlockWet = currentWet;
 	lastBlockFalloff = currentFalloff;
 	lastBlockLoop = loop;
@@ -289,110 +620,464 @@ void PluginProcessor::updateLastBlockParameters()
 void PluginProcessor::updateParametersOnReset()
 {
 	updateCurrentBlockParameters();
-	fadeOut = false;
 	updateLastBlockParameters();
+
+	activeDelay = currentDelay;
+	fadingDelay = currentDelay;
+	activeNumIntervals = currentNumIntervals;
+	fadingNumIntervals = currentNumIntervals;
+	crossfadePosition = crossfadeLength;
+	crossfadeStart = 1;
+	crossfadeEnd = 1;
+	crossfading = false;
+	updateTailLength();
 }
 
-void PluginProcessor::processChannel(float* audio, CircularBuffer* buffer,
-	DelayAmp* amps, Filter* filters)
+void PluginProcessor::updateCrossfade()
 {
-	memcpy(tempBuffer.data(), audio, numSamples * sizeof(float));
+	// a new crossfade time only takes effect between fades, so that none
+	// of them changes length part way through
+	if (crossfadePosition >= crossfadeLength
+		&& fadingLinkRoute == activeLinkRoute)
+	{
+		updateCrossfadeLength();
+		crossfadePosition = crossfadeLength;
+	}
 
-	float dryAmpStart = amps[0].getLastValue();
-	float dryAmpEnd = amps[0].getCurrentValue();
-	processDrySignal(audio, dryAmpStart, dryAmpEnd);
-	processLoopedSignal(audio, buffer, dryAmpStart, dryAmpEnd, filters);
+	// only one crossfade runs at a time; a change that arrives during one is
+	// picked up once it has finished. A change that needs a longer delay line
+	// also waits until the longer one has been allocated in the background,
+	// which takes a few blocks at most
+	bool delayChanged = currentDelay != activeDelay;
+	bool intervalsChanged = currentNumIntervals != activeNumIntervals;
+	size_t neededLength = getDelayLineLength(currentDelay,
+		currentNumIntervals);
+	if (crossfadePosition >= crossfadeLength
+		&& (delayChanged || intervalsChanged) && delayLine.grow(neededLength))
+	{
+		startCrossfade();
+	}
 
-	if (!lastBlockFadeOut)
+	crossfading = crossfadePosition < crossfadeLength;
+	if (crossfading)
 	{
-		buffer->addSamples(tempBuffer.data(), numSamples);
+		float length = static_cast<float>(crossfadeLength);
+		crossfadeStart = static_cast<float>(crossfadePosition) / length;
+		crossfadePosition = juce::jmin(crossfadePosition + numSamples,
+			crossfadeLength);
+		crossfadeEnd = static_cast<float>(crossfadePosition) / length;
 	}
-	else if (!fadeOut)
+	else
 	{
-		buffer->addSamplesRamped(tempBuffer.data(), numSamples);
+		crossfadeStart = 1;
+		crossfadeEnd = 1;
+		fadingDelay = activeDelay;
+		fadingNumIntervals = activeNumIntervals;
+	}
+}
+
+void PluginProcessor::startCrossfade()
+{
+	bool delayChanged = currentDelay != activeDelay;
+	fadingDelay = activeDelay;
+	fadingNumIntervals = activeNumIntervals;
+	activeDelay = currentDelay;
+	activeNumIntervals = currentNumIntervals;
+	crossfadePosition = 0;
+	updateTailLength();
+
+	// the loop head moves whenever the delay or the number of intervals
+	// changes, so the old one keeps its filter while it fades out
+	activeLoopFilterSet = (activeLoopFilterSet + 1) % numFilterSets;
+	leftFilters[activeLoopFilterSet][0].reset();
+	rightFilters[activeLoopFilterSet][0].reset();
+
+	if (delayChanged)
+	{
+		// every tap moves, so the taps at the new spacing start from a clean
+		// filter state while those at the old spacing fade out with theirs
+		activeFilterSet = (activeFilterSet + 1) % numFilterSets;
+		for (size_t i = 1;i < maxIntervals;i++)
+		{
+			leftFilters[activeFilterSet][i].reset();
+			rightFilters[activeFilterSet][i].reset();
+		}
 	}
 	else
+	{
+		// only the taps being added need a clean filter state; the others
+		// carry on as they were
+		for (size_t i = fadingNumIntervals;i < activeNumIntervals;i++)
+		{
+			leftFilters[activeFilterSet][i].reset();
+			rightFilters[activeFilterSet][i].reset();
+		}
+	}
+}
+
+void PluginProcessor::updateTailLength()
+{
+	// the last interval's echo is the last thing heard once the input stops
+	double delay = static_cast<double>(activeDelay * activeNumIntervals);
+	tailLength.store(delay / lastSampleRate);
+}
+
+void PluginProcessor::updateCrossfadeLength()
+{
+	double samples = lastSampleRate * crossfadeTime / 1000;
+	crossfadeLength = juce::jmax((size_t) 1, static_cast<size_t>(samples));
+}
+
+void PluginProcessor::setDelayCrossfadeTime(float milliseconds)
+{
+	// may be called from any thread; the audio thread picks the new length
+	// up once no crossfade is running
+	crossfadeTime = milliseconds;
+}
+
+void PluginProcessor::parameterChanged(const juce::String& id, float value)
+{
+	// the engine options are handed on the way their setters would be
+	int index = static_cast<int>(value);
+	if (id == "filter-engine")
+	{
+		setFilterEngine(index == 0 ? FilterEngine::biquad
+			: FilterEngine::stateVariable);
+	}
+	else if (id == "history-mode")
+	{
+		setHistoryMode(index == 0 ? HistoryMode::inPlace
+			: HistoryMode::readOnly);
+	}
+	else if (id == "delay-storage")
+	{
+		DelayStorage formats[] = { DelayStorage::float32, DelayStorage::half,
+			DelayStorage::dithered16 };
+		setDelayStorage(formats[juce::jlimit(0, 2, index)]);
+		triggerAsyncUpdate();
+	}
+	else if (id == "crossfade-time")
+	{
+		int last = static_cast<int>(numCrossfadeTimes) - 1;
+		setDelayCrossfadeTime(static_cast<float>(
+			crossfadeTimes[juce::jlimit(0, last, index)]));
+	}
+}
+
+void PluginProcessor::valueTreePropertyChanged(juce::ValueTree& changed,
+	const juce::Identifier& property)
+{
+	if (changed == settings
+		&& property == juce::Identifier("lock-delay-memory"))
+	{
+		lockDelayMemory = static_cast<bool>(changed[property]);
+		triggerAsyncUpdate();
+	}
+}
+
+void PluginProcessor::handleAsyncUpdate()
+{
+	// the options the delay line is allocated with only take effect when
+	// it's allocated again, along with the arena that holds its staging
+	// buffer. Nothing else is touched, and the audio callback is held off
+	// meanwhile. Before the host has prepared playback, its prepareToPlay
+	// picks the options up instead
+	if (tempBuffer.getNumSamples() == 0)
 	{
 		return;
 	}
+	suspendProcessing(true);
+	prepareDelayLine(static_cast<size_t>(tempBuffer.getNumSamples()));
+	suspendProcessing(false);
+}
 
-	processWetSignal(audio, buffer, amps, filters);
+void PluginProcessor::setFilterEngine(FilterEngine engine)
+{
+	// may be called from any thread; the switch happens at the next block
+	requestedFilterEngine = engine;
+}
 
-	if (fadeOut)
+void PluginProcessor::updateFilterCoefficients()
+{
+	FilterEngine engine = requestedFilterEngine;
+	if (engine != leftCoefficients.getEngine())
 	{
-		buffer->clear();
-		for (size_t i = 0;i < maxIntervals;i++)
+		// the two engines keep different state, so the filters start over
+		leftCoefficients.setEngine(engine);
+		rightCoefficients.setEngine(engine);
+		resetFilters();
+	}
+
+	// once the right side has settled on the same values as the left while
+	// linked, both follow the left parameters in step, so the right filters
+	// can use the left coefficients instead of working out their own
+	bool filtersLinked = (activeLinkRoute & getLinkBit(filtersLink)) != 0
+		&& !isLinkFading(filtersLink);
+	if (filtersLinked && !rightCoefficientsShared)
+	{
+		rightCoefficientsShared = rightCoefficients.matches(leftCoefficients);
+	}
+
+	leftCoefficients.prepareBlock(numSamples);
+	if (rightCoefficientsShared)
+	{
+		rightCoefficients.skipBlock(numSamples);
+		activeRightCoefficients = &leftCoefficients;
+	}
+	else
+	{
+		rightCoefficients.prepareBlock(numSamples);
+		activeRightCoefficients = &rightCoefficients;
+	}
+}
+
+void PluginProcessor::setHistoryMode(HistoryMode mode)
+{
+	// may be called from any thread; the switch happens at the next block
+	requestedHistoryMode = mode;
+}
+
+void PluginProcessor::setDelayStorage(DelayStorage storage)
+{
+	// the delay line has to be reallocated in the new format, so the switch
+	// happens the next time it's allocated
+	requestedDelayStorage = storage;
+}
+
+void PluginProcessor::setDelayMemoryLocked(bool shouldLock)
+{
+	// a machine setting, so it's kept out of the saved state. Takes effect
+	// the next time the delay line is allocated. Locking is best effort,
+	// since the system may limit how much memory can be locked
+	settings.setProperty("lock-delay-memory", shouldLock, nullptr);
+}
+
+void PluginProcessor::updateHistoryMode()
+{
+	HistoryMode mode = requestedHistoryMode;
+	if (mode == historyMode)
+	{
+		return;
+	}
+
+	// what's in the delay line means something different in each mode (in
+	// place, it has been filtered by the taps it has passed), so it's
+	// cleared rather than played through the wrong taps
+	historyMode = mode;
+	delayLine.clear();
+	resetFilters();
+}
+
+void PluginProcessor::resetFilters()
+{
+	for (size_t set = 0;set < numFilterSets;set++)
+	{
+		for (int i = 0;i < maxIntervals;i++)
 		{
-			filters[i].reset();
+			leftFilters[set][i].reset();
+			rightFilters[set][i].reset();
 		}
 	}
 }
 
+void PluginProcessor::processChannels(float* left, float* right)
+{
+	// the host's buffer holds the input until the output is mixed into it at
+	// the end, so the input goes into the delay line straight from there
+	float* loopLeft = tempBuffer.getWritePointer(2);
+	float* loopRight = tempBuffer.getWritePointer(3);
+	if (loop || lastBlockLoop)
+	{
+		processLoopedSignal();
+
+		// the looped signal goes round the delay line again and again, so
+		// once it has faded out it's set to zero rather than left to decay
+		// through the subnormal range
+		SampleKernels::snapToZero(loopLeft, numSamples);
+		SampleKernels::snapToZero(loopRight, numSamples);
+
+		// feed the looped signal back into the delay line's input
+		float feedbackStart = lastBlockLoop ? 1 : 0;
+		float feedbackEnd = loop ? 1 : 0;
+		float feedbackStep = (feedbackEnd - feedbackStart)
+			/ static_cast<float>(numSamples);
+		delayLine.addSamplesWithFeedback(left, right, loopLeft, loopRight,
+			numSamples, feedbackStart, feedbackStep);
+	}
+	else
+	{
+		delayLine.addSamples(left, right, numSamples);
+	}
+	processWetSignal();
+
+	mixOutput(left, tempBuffer.getReadPointer(0), loopLeft,
+		leftAmps[0].getLastValue(), leftAmps[0].getCurrentValue());
+	mixOutput(right, tempBuffer.getReadPointer(1), loopRight,
+		rightAmps[0].getLastValue(), rightAmps[0].getCurrentValue());
+}
 
-void PluginProcessor::processDrySignal(float* audio, float ampStart,
-	float ampEnd)
+void PluginProcessor::processLoopedSignal()
 {
-	float step = (ampEnd - ampStart) / numSamples;
-	for (size_t i = 0;i < numSamples;i++)
+	float* loopLeft = tempBuffer.getWritePointer(2);
+	float* loopRight = tempBuffer.getWritePointer(3);
+	tempBuffer.clear(2, 0, (int) numSamples);
+	tempBuffer.clear(3, 0, (int) numSamples);
+
+	// the loop head sits a block ahead of the last interval, since it's read
+	// before this block's input is added to the delay line
+	TapGains unity = { 1, 1, 1, 1 };
+	if (crossfading)
 	{
-		ampStart += step;
-		audio[i] *= ampStart;
+		size_t fadingSet = (activeLoopFilterSet + 1) % numFilterSets;
+		size_t delay = fadingDelay * fadingNumIntervals - numSamples;
+		processHead(delay, fadingSet, 0, fadingNumIntervals, loopLeft,
+			loopRight, unity, 1 - crossfadeStart, 1 - crossfadeEnd, false);
 	}
+	size_t delay = activeDelay * activeNumIntervals - numSamples;
+	processHead(delay, activeLoopFilterSet, 0, activeNumIntervals, loopLeft,
+		loopRight, unity, crossfadeStart, crossfadeEnd, true);
 }
 
-void PluginProcessor::processLoopedSignal(float* audio, CircularBuffer* buffer,
-	float ampStart, float ampEnd, Filter* filters)
+void PluginProcessor::processWetSignal()
 {
-	if (!loop && !lastBlockLoop)
+	TRACE_DSP();
+	float* tempLeft = tempBuffer.getWritePointer(0);
+	float* tempRight = tempBuffer.getWritePointer(1);
+	tempBuffer.clear(0, 0, (int) numSamples);
+	tempBuffer.clear(1, 0, (int) numSamples);
+
+	// outside of a crossfade, taps spaced at least a block apart never
+	// overlap, so they can all be processed in lock step
+	bool lockStep = !crossfading && activeDelay >= numSamples
+		&& historyMode == HistoryMode::inPlace;
+	CircularBuffer::LockStepTap taps[maxIntervals];
+	size_t numTaps = 0;
+
+	// every amp is read once a block (reading its ramp moves it on), whether
+	// or not its tap ends up running
+	TapGains tapGains[maxIntervals];
+	uint32_t audibleTaps = 0;
+	size_t numIntervals = juce::jmax(activeNumIntervals, fadingNumIntervals);
+	for (size_t i = 1;i < numIntervals;i++)
 	{
-		return;
+		TapGains& gains = tapGains[i];
+		gains.leftStart = leftAmps[i].getLastValue();
+		gains.leftEnd = leftAmps[i].getCurrentValue();
+		gains.rightStart = rightAmps[i].getLastValue();
+		gains.rightEnd = rightAmps[i].getCurrentValue();
+		if (gains.leftStart > 0 || gains.leftEnd > 0 || gains.rightStart > 0
+			|| gains.rightEnd > 0)
+		{
+			audibleTaps |= 1u << i;
+		}
 	}
+	tapPlan.update(audibleTaps, numIntervals,
+		historyMode == HistoryMode::inPlace);
 
-	size_t loopDelay = lastBlockDelay * lastBlockNumIntervals - numSamples;
-	buffer->applyGainToSamples(loopDelay, numSamples, lastBlockFalloff,
+	for (size_t step = 0;step < tapPlan.getNumTaps();step++)
+	{
+		size_t i = tapPlan.getInterval(step);
+		const TapGains& gains = tapGains[i];
+		if (lockStep)
+		{
+			CircularBuffer::LockStepTap& tap = taps[numTaps++];
+			tap.delay = activeDelay * i;
+			tap.left = { &leftFilters[activeFilterSet][i], &leftCoefficients,
+				tempLeft, gains.leftStart, gains.leftEnd };
+			tap.right = { &rightFilters[activeFilterSet][i],
+				activeRightCoefficients, tempRight, gains.rightStart,
+				gains.rightEnd };
+		}
+		else
+		{
+			processCrossfadedTap(i, tempLeft, tempRight, gains);
+		}
+	}
+	delayLine.processTaps(taps, numTaps, numSamples, lastBlockFalloff,
 		currentFalloff);
-	buffer->applyFilterToSamples(loopDelay, numSamples, &filters[0]);
-
-	float feedbackStart = lastBlockLoop ? 1 : 0;
-	float feedbackEnd = loop ? 1 : 0;
-	buffer->sumWithSamplesRamped(loopDelay, tempBuffer.data(), numSamples,
-		feedbackStart, feedbackEnd);
-
-	feedbackStart *= lastBlockWet * ampStart;
-	feedbackEnd *= currentWet * ampEnd;
-	buffer->sumWithSamplesRamped(loopDelay, audio, numSamples, feedbackStart,
-		feedbackEnd);
 }
 
-void PluginProcessor::processWetSignal(float* audio, CircularBuffer* buffer,
-	DelayAmp* amps, Filter* filters)
+void PluginProcessor::processCrossfadedTap(size_t interval, float* leftOut,
+	float* rightOut, TapGains gains)
 {
-	memset(tempBuffer.data(), 0, tempBuffer.size() * sizeof(float));
+	bool active = interval < activeNumIntervals;
+	bool fading = crossfading && interval < fadingNumIntervals;
+	float activeStart = active ? crossfadeStart : 0;
+	float activeEnd = active ? crossfadeEnd : 0;
+	float fadingStart = fading ? 1 - crossfadeStart : 0;
+	float fadingEnd = fading ? 1 - crossfadeEnd : 0;
+
+	if (activeDelay == fadingDelay)
+	{
+		// only the number of intervals is changing, so a tap that exists on
+		// both sides of the crossfade is played at full level, and a tap
+		// being removed just reads the delay line as it fades out
+		processHead(activeDelay * interval, activeFilterSet, interval,
+			interval, leftOut, rightOut, gains, activeStart + fadingStart,
+			activeEnd + fadingEnd, active);
+		return;
+	}
 
-	for (size_t i = lastBlockNumIntervals - 1;i > 0;i--)
+	// taps at the old spacing only read the delay line, so every sample in it
+	// is processed once, at the new spacing
+	if (fading)
+	{
+		size_t fadingSet = (activeFilterSet + 1) % numFilterSets;
+		processHead(fadingDelay * interval, fadingSet, interval, interval,
+			leftOut, rightOut, gains, fadingStart, fadingEnd, false);
+	}
+	if (active)
 	{
-		size_t intervalDelay = lastBlockDelay * i;
-		buffer->applyGainToSamples(intervalDelay, numSamples, lastBlockFalloff,
-			currentFalloff);
-		buffer->applyFilterToSamples(intervalDelay, numSamples, &filters[i]);
+		processHead(activeDelay * interval, activeFilterSet, interval,
+			interval, leftOut, rightOut, gains, activeStart, activeEnd, true);
+	}
+}
 
-		float g1 = amps[i].getLastValue();
-		float g2 = amps[i].getCurrentValue();
-		buffer->sumWithSamplesRamped(intervalDelay, tempBuffer.data(),
-			numSamples, g1, g2);
+void PluginProcessor::processHead(size_t delay, size_t filterSet,
+	size_t filterIndex, size_t numStages, float* leftOut, float* rightOut,
+	TapGains gains, float levelStart, float levelEnd, bool inPlace)
+{
+	CircularBuffer::TapOutput leftTap = {
+		&leftFilters[filterSet][filterIndex], &leftCoefficients, leftOut,
+		gains.leftStart * levelStart, gains.leftEnd * levelEnd };
+	CircularBuffer::TapOutput rightTap = {
+		&rightFilters[filterSet][filterIndex], activeRightCoefficients,
+		rightOut,
+		gains.rightStart * levelStart, gains.rightEnd * levelEnd };
+	if (historyMode == HistoryMode::readOnly)
+	{
+		// the falloff of every stage is applied at once, at the input
+		float stages = static_cast<float>(numStages);
+		delayLine.processCascadedTap(delay, numSamples, numStages,
+			std::pow(lastBlockFalloff, stages),
+			std::pow(currentFalloff, stages), leftTap, rightTap);
+		return;
 	}
 
-	float wet = lastBlockWet;
-	float wetStep = (currentWet - lastBlockWet) / numSamples;
-	float fade = 1;
-	float fadeStep = fadeOut ? (1.0f / numSamples) : 0;
+	delayLine.processTap(delay, numSamples, lastBlockFalloff, currentFalloff,
+		leftTap, rightTap, inPlace);
+}
 
-	for (size_t i = 0;i < numSamples;i++)
+void PluginProcessor::mixOutput(float* audio, const float* wetSignal,
+	const float* loopSignal, float dryStart, float dryEnd)
+{
+	// each output sample is written once: the dry signal, then the looped
+	// signal (which plays in place of the dry signal), then the wet signal
+	float length = static_cast<float>(numSamples);
+	SampleKernels::RampedInput inputs[2];
+	size_t numInputs = 0;
+	if (loop || lastBlockLoop)
 	{
-		fade -= fadeStep;
-		wet += wetStep;
-		audio[i] += tempBuffer[i] * wet * fade;
+		float loopStart = (lastBlockLoop ? lastBlockWet : 0) * dryStart;
+		float loopEnd = (loop ? currentWet : 0) * dryEnd;
+		inputs[numInputs++] = { loopSignal, loopStart,
+			(loopEnd - loopStart) / length };
 	}
+	inputs[numInputs++] = { wetSignal, lastBlockWet,
+		(currentWet - lastBlockWet) / length };
+
+	SampleKernels::mixRamped(audio, numSamples, dryStart,
+		(dryEnd - dryStart) / length, inputs, numInputs);
 }
 
 void PluginProcessor::resetLeftAmps()
@@ -449,44 +1134,6 @@ void PluginProcessor::copyRightAmpsToLeft()
 	}
 }
 
-void PluginProcessor::linkFilters()
-{
-	std::string high = "left-high-pass";
-	std::string low = "left-low-pass";
-	std::string mix = "left-filter-mix";
-	for (size_t i = 0;i < maxIntervals;i++)
-	{
-		rightFilters[i].attachToParameters(&tree, high, low, mix);
-	}
-}
-
-void PluginProcessor::unlinkFilters()
-{
-	std::string high = "right-high-pass";
-	std::string low = "right-low-pass";
-	std::string mix = "right-filter-mix";
-	for (size_t i = 0;i < maxIntervals;i++)
-	{
-		rightFilters[i].attachToParameters(&tree, high, low, mix);
-	}
-}
-
-void PluginProcessor::linkDelays()
-{
-	for (int i = 0;i < maxIntervals;i++)
-	{
-		rightAmps[i].listenTo(&tree, getIdForLeftIntervalAmp(i));
-	}
-}
-
-void PluginProcessor::unlinkDelays()
-{
-	for (int i = 0;i < maxIntervals;i++)
-	{
-		rightAmps[i].listenTo(&tree, getIdForRightIntervalAmp(i));
-	}
-}
-
 void PluginProcessor::getStateInformation(juce::MemoryBlock &destData)
 {
 	auto state = tree.copyState();
@@ -523,15 +1170,15 @@ size_t PluginProcessor::getDelaySamples()
 {
 	size_t result;
 
-	if (*tree.getRawParameterValue("tempo-sync") >= 1)
+	if (snapshot.get(ParameterSnapshot::tempoSync) >= 1)
 	{
-		float noteIndex = *tree.getRawParameterValue("delay-time-sync");
+		float noteIndex = snapshot.get(ParameterSnapshot::delayTimeSync);
 		float sec = getSecondsForNoteValue((int) noteIndex);
 		result = static_cast<size_t>(lastSampleRate * sec);
 	}
 	else
 	{
-		float ms = *tree.getRawParameterValue("delay-time");
+		float ms = snapshot.get(ParameterSnapshot::delayTime);
 		result = static_cast<size_t>(lastSampleRate * ms / 1000);
 	}
 	
@@ -539,7 +1186,14 @@ size_t PluginProcessor::getDelaySamples()
 	return juce::jmin(result, limit);
 }
 
+size_t PluginProcessor::getDelayLineLength(size_t delay,
+	size_t numIntervals)
+{
+	// the furthest tap reads a whole sub-block from that far back
+	return delay * numIntervals + maxSubBlockSize;
+}
+
 size_t PluginProcessor::getCurrentNumIntervals()
 {
-	return static_cast<size_t>(*tree.getRawParameterValue("num-intervals"));
+	return static_cast<size_t>(snapshot.get(ParameterSnapshot::numIntervals));
 }
\ No newline at end of file
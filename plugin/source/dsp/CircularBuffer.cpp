@@ -1,204 +1,718 @@
 #include "CircularBuffer.h"
 #include <juce_audio_basics/juce_audio_basics.h>
 #include "Filter.h"
+#include "SampleKernels.h"
 
 CircularBuffer::CircularBuffer() : CircularBuffer(1024) { }
 
-CircularBuffer::CircularBuffer(size_t capacity) : sampleCount(0)
+CircularBuffer::CircularBuffer(size_t initialCapacity)
+    : segmentLength(0), capacity(0), sampleCount(0), numClears(0),
+    storage(DelayStorage::float32), staging(nullptr), maxStagedFrames(0),
+    spareCapacity(0), spareSegmentLength(0),
+    spareStorage(DelayStorage::float32), grownFrom(0), snapshotCount(0),
+    snapshotClears(0), numRewrites(0), trackingRewrites(false),
+    rewritesOverflowed(false), lockMemory(false), growth(Growth::idle)
 {
-    resize(capacity);
+    resize(initialCapacity);
+    growthThread->addBuffer(this);
 }
 
-void CircularBuffer::addSample(const float sample)
+CircularBuffer::~CircularBuffer()
 {
-    buffer[capacityMask(sampleCount++)] = sample;
+    growthThread->removeBuffer(this);
 }
 
-void CircularBuffer::addSamples(const float* samples, size_t numToAdd)
+void CircularBuffer::addSamples(const float* left, const float* right,
+    size_t numToAdd)
 {
-    jassert(numToAdd <= buffer.size());
+    jassert(numToAdd <= capacity);
 
-    size_t startSample = capacityMask(sampleCount);
-    size_t spaceBeforeWrap = buffer.size() - startSample;
-    size_t numPreWrap = juce::jmin(numToAdd, spaceBeforeWrap);
-    size_t numPostWrap = numToAdd - numPreWrap;
+    Window run = beginWrite(numToAdd);
+    SampleKernels::interleave(run.samples, left, right, run.numPreWrap);
+    SampleKernels::interleave(run.wrapped, left + run.numPreWrap,
+        right + run.numPreWrap, run.numPostWrap);
+    endWrite(run, numToAdd);
+}
 
-    memcpy(buffer.data() + startSample, samples, numPreWrap * sizeof(float));
-    memcpy(buffer.data(), samples + numPreWrap, numPostWrap * sizeof(float));
+void CircularBuffer::addSamplesWithFeedback(const float* left,
+    const float* right, const float* feedbackLeft, const float* feedbackRight,
+    size_t numToAdd, float startGain, float gainStep)
+{
+    jassert(numToAdd <= capacity);
+
+    // the feedback is summed in as the frames are written, rather than added
+    // to a copy of the input first
+    Window run = beginWrite(numToAdd);
+    SampleKernels::interleaveWithAddRamped(run.samples, left, right,
+        feedbackLeft, feedbackRight, run.numPreWrap, startGain, gainStep);
+    size_t n = run.numPreWrap;
+    SampleKernels::interleaveWithAddRamped(run.wrapped, left + n, right + n,
+        feedbackLeft + n, feedbackRight + n, run.numPostWrap, startGain,
+        gainStep, n);
+    endWrite(run, numToAdd);
+}
 
-    sampleCount += numToAdd;
+CircularBuffer::Window CircularBuffer::getWindow(size_t delay, size_t length,
+    size_t stagingSlot)
+{
+    size_t startSample = getStartSample(delay, length);
+    Window window;
+    if (isPacked())
+    {
+        // the staged frames are contiguous, so the window never wraps
+        jassert(length <= maxStagedFrames);
+        float* staged = staging
+            + stagingSlot * maxStagedFrames * numChannels;
+        unpackFrames(staged, startSample, length);
+        window = { staged, length, staged, 0 };
+    }
+    else
+    {
+        window = getRun(startSample, length);
+    }
+    zeroStaleFrames(window, delay, length);
+    return window;
 }
 
-void CircularBuffer::addSamplesRamped(const float* samples, size_t numToAdd)
+void CircularBuffer::processTap(size_t delay, size_t length, float startGain,
+    float endGain, TapOutput left, TapOutput right, bool inPlace)
 {
-    // sampleCount changes as a result of addSamples, so save its value here
-    size_t startSample = capacityMask(sampleCount);
-    addSamples(samples, numToAdd);
+    Window window = getWindow(delay, length);
+    float gainStep = (endGain - startGain) / static_cast<float>(length);
+
+    // both channels share the window's cache lines, so the second channel's
+    // pass reads memory the first has just brought in
+    processTapChannel(window, 0, length, startGain, gainStep, left, inPlace);
+    processTapChannel(window, 1, length, startGain, gainStep, right, inPlace);
+    if (inPlace)
+    {
+        writeBack(window, delay, length);
+    }
+}
 
-    float gain = 0;
-    float gainStep = 1.0f / numToAdd;
-    size_t numPreWrap = juce::jmin(numToAdd, buffer.size() - startSample);
-    size_t numPostWrap = numToAdd - numPreWrap;
+void CircularBuffer::processCascadedTap(size_t delay, size_t length,
+    size_t numStages, float startGain, float endGain, TapOutput left,
+    TapOutput right)
+{
+    // the delay line is only read, and each tap's filter runs the samples
+    // through as many stages as the in-place taps before it would have
+    Window window = getWindow(delay, length);
+    float gainStep = (endGain - startGain) / static_cast<float>(length);
+
+    processCascadedTapChannel(window, 0, length, numStages, startGain,
+        gainStep, left);
+    processCascadedTapChannel(window, 1, length, numStages, startGain,
+        gainStep, right);
+}
+
+void CircularBuffer::processTaps(const LockStepTap* taps, size_t numTaps,
+    size_t length, float startGain, float endGain)
+{
+    // the taps must not overlap (so no tap reads what another writes in the
+    // same block), and they must share their coefficients and outputs
+    jassert(numTaps <= maxLockStepTaps);
+    if (numTaps == 0)
+    {
+        return;
+    }
 
-    for (size_t i = startSample;i < numPreWrap;i++)
+    float frames = static_cast<float>(length);
+    Filter::InterleavedTap lanes[maxLockStepTaps];
+    for (size_t i = 0;i < numTaps;i++)
     {
-        gain += gainStep;
-        buffer[i] *= gain;
+        const LockStepTap& tap = taps[i];
+        Window window = getWindow(tap.delay, length, i);
+        if (window.numPostWrap > 0)
+        {
+            // a window that wraps isn't one run of frames, so fall back to
+            // processing the taps one at a time
+            for (size_t j = 0;j < numTaps;j++)
+            {
+                processTap(taps[j].delay, length, startGain, endGain,
+                    taps[j].left, taps[j].right);
+            }
+            return;
+        }
+
+        lanes[i].frames = window.samples;
+        lanes[i].left = tap.left.filter;
+        lanes[i].right = tap.right.filter;
+        lanes[i].leftAmp = tap.left.startAmp;
+        lanes[i].leftAmpStep = (tap.left.endAmp - tap.left.startAmp) / frames;
+        lanes[i].rightAmp = tap.right.startAmp;
+        lanes[i].rightAmpStep = (tap.right.endAmp - tap.right.startAmp)
+            / frames;
     }
-    for (size_t i = 0;i < numPostWrap;i++)
+
+    float gainStep = (endGain - startGain) / frames;
+    Filter::processTaps(*taps[0].left.coefficients,
+        *taps[0].right.coefficients, lanes, numTaps, length, startGain,
+        gainStep, taps[0].left.output, taps[0].right.output);
+    for (size_t i = 0;i < numTaps;i++)
     {
-        gain *= gainStep;
-        buffer[i] *= gain;
+        Window window = { lanes[i].frames, length, lanes[i].frames, 0 };
+        writeBack(window, taps[i].delay, length);
     }
 }
 
-float CircularBuffer::getSample(size_t delay)
+void CircularBuffer::clear()
 {
-    return buffer[capacityMask(sampleCount - 1 - delay)];
+    sampleCount = 0;
+    numClears++;
 }
 
-void CircularBuffer::getSamples(size_t delay, float* output, size_t length)
+void CircularBuffer::resize(size_t newLength)
 {
-    jassert(length <= buffer.size());
+    // a power of two up to a full segment, or any number of full segments
+    size_t newSegmentLength = getSegmentLength(newLength, storage);
+    jassert(juce::isPowerOfTwo(newSegmentLength) && newSegmentLength >= 2);
+    jassert(newLength % newSegmentLength == 0);
+
+    // the old segments are freed before the new ones are allocated, once
+    // the growth thread has finished reading them
+    const juce::ScopedLock lock(layoutLock);
+    segments.clear();
+    for (size_t i = 0;i < newLength / newSegmentLength;i++)
+    {
+        segments.push_back(allocateSegment(newSegmentLength, storage,
+            lockMemory));
+    }
+    segmentLength = newSegmentLength;
+    capacity = newLength;
+    clear();
+}
 
-    size_t start = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - start);
-    size_t numPostWrap = length - numPreWrap;
+void CircularBuffer::prepare(size_t minLength, size_t maxBlockLength,
+    DelayStorage newStorage)
+{
+    // not called while processing, so a buffer that's too short (or in the
+    // wrong format) can be replaced right away. One that's long enough (say,
+    // after a change of sample rate) is kept as it is. The growth thread
+    // checks the format against its request, so it changes under the lock
+    const juce::ScopedLock lock(layoutLock);
+    if (newStorage != storage || minLength > capacity)
+    {
+        storage = newStorage;
+        resize(getLengthFor(minLength, storage));
+    }
 
-    memcpy(output, buffer.data() + start, numPreWrap * sizeof(float));
-    memcpy(output + numPreWrap, buffer.data(), numPostWrap * sizeof(float));
+    maxStagedFrames = isPacked() ? maxBlockLength : 0;
+    clear();
 }
 
-void CircularBuffer::sumWithSamples(size_t delay, float* output, size_t length,
-    float gain)
+void CircularBuffer::allocate(DspArena& arena)
 {
-    if (juce::approximatelyEqual(gain, 0.0f))
+    // the staging buffer is only needed by the 16-bit formats
+    staging = nullptr;
+    if (isPacked())
     {
-        return;
+        size_t length = maxLockStepTaps * maxStagedFrames * numChannels;
+        staging = arena.allocate<float>("delay line staging", length);
     }
+}
 
-    size_t start = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - start);
-    size_t numPostWrap = length - numPreWrap;
+bool CircularBuffer::grow(size_t minLength)
+{
+    if (minLength <= capacity)
+    {
+        return true;
+    }
 
-    for (size_t i = 0;i < numPreWrap;i++)
+    Growth state = growth.load(std::memory_order_acquire);
+    if (state == Growth::ready)
     {
-        output[i] += buffer[i + start] * gain;
+        // a buffer grown for an earlier request may have been overtaken by
+        // a call to prepare or clear, in which case it's simply handed back
+        if (canSwapInSpare())
+        {
+            swapInSpare();
+        }
+        trackingRewrites = false;
+        growth.store(Growth::retired, std::memory_order_release);
+        growthThread->notify();
+        return minLength <= capacity;
     }
-    for (size_t i = 0;i < numPostWrap;i++)
+    if (state == Growth::idle)
     {
-        output[i + numPreWrap] += buffer[i] * gain;
+        spareCapacity = getLengthFor(minLength, storage);
+        spareSegmentLength = getSegmentLength(spareCapacity, storage);
+        spareStorage = storage;
+        grownFrom = capacity;
+        snapshotCount = sampleCount;
+        snapshotClears = numClears;
+        numRewrites = 0;
+        rewritesOverflowed = false;
+        trackingRewrites = true;
+        growth.store(Growth::requested, std::memory_order_release);
+        growthThread->notify();
     }
+    return false;
 }
 
-void CircularBuffer::sumWithSamplesRamped(size_t delay, float* output,
-    size_t length, float startGain, float endGain)
+void CircularBuffer::setLocked(bool shouldLock)
 {
-    if (juce::approximatelyEqual(startGain, endGain))
+    // not called while processing, so the buffer can't be swapped meanwhile
+    lockMemory = shouldLock;
+    for (size_t i = 0;i < segments.size();i++)
     {
-        sumWithSamples(delay, output, length, startGain);
-        return;
+        segments[i]->setLocked(shouldLock);
     }
+}
+
+CircularBuffer::GrowthThread::GrowthThread()
+    : juce::Thread("Delay Line Growth")
+{
+    startThread();
+}
+
+CircularBuffer::GrowthThread::~GrowthThread()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(1000);
+}
 
-    size_t start = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - start);
-    size_t numPostWrap = length - numPreWrap;
-    float gain = startGain;
-    float gainStep = (endGain - startGain) / length;
+void CircularBuffer::GrowthThread::addBuffer(CircularBuffer* buffer)
+{
+    const juce::ScopedLock scopedLock(lock);
+    buffers.add(buffer);
+}
+
+void CircularBuffer::GrowthThread::removeBuffer(CircularBuffer* buffer)
+{
+    // waits for the thread if it's working on this buffer
+    const juce::ScopedLock scopedLock(lock);
+    buffers.removeFirstMatchingValue(buffer);
+}
+
+void CircularBuffer::GrowthThread::run()
+{
+    // a delay line notifies the thread whenever it asks for a buffer or
+    // hands one back, and a notification that arrives while the thread is
+    // busy wakes it again straight away
+    while (!threadShouldExit())
+    {
+        wait(-1);
+        const juce::ScopedLock scopedLock(lock);
+        for (int i = 0;i < buffers.size();i++)
+        {
+            buffers.getUnchecked(i)->serviceGrowth();
+        }
+    }
+}
 
-    for (size_t i = 0;i < numPreWrap;i++)
+void CircularBuffer::serviceGrowth()
+{
+    Growth state = growth.load(std::memory_order_acquire);
+    if (state == Growth::requested)
+    {
+        Segments grown;
+        for (size_t i = 0;i < spareCapacity / spareSegmentLength;i++)
+        {
+            grown.push_back(allocateSegment(spareSegmentLength, spareStorage,
+                lockMemory));
+        }
+
+        // the audio thread keeps writing to the buffer while it's copied,
+        // so some of the frames may be copied half written. Those are all
+        // frames written since the snapshot, which it copies again when it
+        // swaps the longer buffer in
+        {
+            const juce::ScopedLock lock(layoutLock);
+            if (!isSnapshotCurrent())
+            {
+                // prepare or clear has replaced the history since the
+                // request, so there's nothing to copy (and the frames are a
+                // different size). The next call to grow asks again
+                grown.clear();
+                growth.store(Growth::idle, std::memory_order_release);
+                return;
+            }
+
+            size_t numFrames = juce::jmin(snapshotCount, capacity);
+            copyFrames(segments, capacity, grown, spareCapacity,
+                snapshotCount - numFrames, numFrames);
+        }
+        spare = std::move(grown);
+        growth.store(Growth::ready, std::memory_order_release);
+    }
+    else if (state == Growth::retired)
     {
-        gain += gainStep;
-        output[i] += buffer[i + start] * gain;
+        spare.clear(); // frees the old buffer, or the unused longer one
+        growth.store(Growth::idle, std::memory_order_release);
     }
-    for (size_t i = 0;i < numPostWrap;i++)
+}
+
+bool CircularBuffer::isSnapshotCurrent()
+{
+    // the history the spare was asked for is still the buffer's own
+    return grownFrom == capacity && spareStorage == storage
+        && snapshotClears == numClears;
+}
+
+bool CircularBuffer::canSwapInSpare()
+{
+    // the snapshot is no use once the buffer has been replaced or cleared,
+    // once the taps have rewritten more runs than could be kept track of,
+    // or once the frames written since have wrapped all the way around
+    return isSnapshotCurrent() && !rewritesOverflowed
+        && sampleCount - snapshotCount <= capacity;
+}
+
+void CircularBuffer::swapInSpare()
+{
+    // the longer buffer holds the history as it was at the snapshot, so
+    // only what has changed since is copied: the runs the taps filtered in
+    // place (those older than the buffer's length have since been
+    // overwritten), then the frames written since the snapshot
+    size_t oldest = sampleCount - juce::jmin(sampleCount, capacity);
+    for (size_t i = 0;i < numRewrites;i++)
     {
-        gain += gainStep;
-        output[i + numPreWrap] += buffer[i] * gain;
+        size_t start = juce::jmax(rewrites[i].startSample, oldest);
+        size_t end = juce::jmin(rewrites[i].startSample + rewrites[i].length,
+            snapshotCount);
+        if (start < end)
+        {
+            copyFrames(segments, capacity, spare, spareCapacity, start,
+                end - start);
+        }
     }
+    copyFrames(segments, capacity, spare, spareCapacity, snapshotCount,
+        sampleCount - snapshotCount);
+
+    // the frames written since the snapshot overwrote the oldest frames
+    // that were copied, which are silence in the longer buffer
+    size_t lostFrom = snapshotCount - juce::jmin(snapshotCount, capacity);
+    zeroFrames(spare, spareCapacity, lostFrom, oldest - lostFrom);
+
+    std::swap(segments, spare);
+    std::swap(capacity, spareCapacity);
+    std::swap(segmentLength, spareSegmentLength);
 }
 
-void CircularBuffer::applyGainToSamples(size_t delay, size_t length,
-    float gain)
+void CircularBuffer::trackRewrite(size_t delay, size_t length)
 {
-    if (juce::approximatelyEqual(gain, 1.0f))
+    // frames from before the last clear are silence, and aren't tracked
+    if (!trackingRewrites || delay >= sampleCount)
     {
         return;
     }
 
-    size_t start = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - start);
-    size_t numPostWrap = length - numPreWrap;
+    // a tap filters its windows one block after another, so a run that
+    // carries on from one already tracked extends it
+    size_t end = sampleCount - delay;
+    size_t start = end - juce::jmin(length, end);
+    for (size_t i = 0;i < numRewrites;i++)
+    {
+        if (rewrites[i].startSample + rewrites[i].length == start)
+        {
+            rewrites[i].length += end - start;
+            return;
+        }
+    }
 
-    for (size_t i = 0;i < numPreWrap;i++)
+    if (numRewrites == maxRewrites)
     {
-        buffer[start + i] *= gain;
+        rewritesOverflowed = true;
+        return;
     }
-    for (size_t i = 0;i < numPostWrap;i++)
+    rewrites[numRewrites++] = { start, end - start };
+}
+
+void CircularBuffer::copyFrames(const Segments& from, size_t fromCapacity,
+    Segments& to, size_t toCapacity, size_t firstSample, size_t numFrames)
+{
+    // both buffers are in the spare's storage format, which is the same as
+    // the current one whenever a spare is copied to
+    size_t frameBytes = numChannels * getBytesPerSample(spareStorage);
+    size_t sample = firstSample;
+    while (numFrames > 0)
     {
-        buffer[i] *= gain;
+        size_t numFrom;
+        size_t numTo;
+        unsigned char* source = locate(from, fromCapacity, sample, numFrom);
+        unsigned char* destination = locate(to, toCapacity, sample, numTo);
+        size_t run = juce::jmin(numFrames, numFrom, numTo);
+        memcpy(destination, source, run * frameBytes);
+        sample += run;
+        numFrames -= run;
     }
 }
 
-void CircularBuffer::applyGainToSamples(size_t delay, size_t length,
-    float startGain, float endGain)
+void CircularBuffer::zeroFrames(Segments& table, size_t tableCapacity,
+    size_t firstSample, size_t numFrames)
 {
-    if (juce::approximatelyEqual(startGain, endGain))
+    size_t frameBytes = numChannels * getBytesPerSample(spareStorage);
+    size_t sample = firstSample;
+    while (numFrames > 0)
     {
-        applyGainToSamples(delay, length, startGain);
-        return;
+        size_t numInSegment;
+        unsigned char* frames = locate(table, tableCapacity, sample,
+            numInSegment);
+        size_t run = juce::jmin(numFrames, numInSegment);
+        memset(frames, 0, run * frameBytes);
+        sample += run;
+        numFrames -= run;
     }
+}
 
-    size_t startSample = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - startSample);
-    size_t numPostWrap = length - numPreWrap;
-    float gain = startGain;
-    float gainStep = (endGain - startGain) / length;
+unsigned char* CircularBuffer::locate(const Segments& table,
+    size_t tableCapacity, size_t sample, size_t& numInSegment)
+{
+    // the bytes of a frame in a buffer made of the given segments, and how
+    // many frames there are from it to the end of its segment
+    size_t length = tableCapacity / table.size();
+    size_t position = sample % tableCapacity;
+    size_t frame = position % length;
+    numInSegment = length - frame;
+
+    size_t frameBytes = numChannels * getBytesPerSample(spareStorage);
+    auto* bytes = reinterpret_cast<unsigned char*>(
+        table[position / length]->data());
+    return bytes + frame * frameBytes;
+}
 
-    for (size_t i = 0;i < numPreWrap;i++)
+size_t CircularBuffer::getLengthFor(size_t minLength, DelayStorage format)
+{
+    // a power of two while it fits in one segment, and whole segments after
+    int length = static_cast<int>(juce::jmax(minLength, (size_t) 2));
+    size_t powerOfTwo = static_cast<size_t>(juce::nextPowerOfTwo(length));
+    size_t fullSegment = getSegmentLength(powerOfTwo, format);
+    if (powerOfTwo <= fullSegment)
     {
-        gain += gainStep;
-        buffer[startSample + i] *= gain;
+        return powerOfTwo;
     }
-    for (size_t i = 0;i < numPostWrap;i++)
+    size_t numSegments = (minLength + fullSegment - 1) / fullSegment;
+    return numSegments * fullSegment;
+}
+
+size_t CircularBuffer::getSegmentLength(size_t length, DelayStorage format)
+{
+    size_t fullSegment = segmentBytes / (numChannels
+        * getBytesPerSample(format));
+    return juce::jmin(length, fullSegment);
+}
+
+size_t CircularBuffer::getBytesPerSample(DelayStorage format)
+{
+    return format == DelayStorage::float32 ? sizeof(float) : sizeof(uint16_t);
+}
+
+size_t CircularBuffer::getMemoryLength(size_t frames, DelayStorage format)
+{
+    // the memory is allocated as floats, two 16-bit samples to a float
+    return frames * numChannels * getBytesPerSample(format) / sizeof(float);
+}
+
+std::unique_ptr<DelayMemory> CircularBuffer::allocateSegment(size_t length,
+    DelayStorage format, bool locked)
+{
+    std::unique_ptr<DelayMemory> segment = std::make_unique<DelayMemory>();
+    segment->setLocked(locked);
+    segment->allocate(getMemoryLength(length, format));
+    return segment;
+}
+
+bool CircularBuffer::isPacked()
+{
+    return storage != DelayStorage::float32;
+}
+
+uint16_t* CircularBuffer::getPackedSamples(size_t segment)
+{
+    return reinterpret_cast<uint16_t*>(segments[segment]->data());
+}
+
+size_t CircularBuffer::getStartSample(size_t delay, size_t length)
+{
+    // a window reaching back past the last clear would start before the
+    // first sample, so it starts a whole buffer later instead, which is the
+    // same place in the buffer
+    if (delay + length > sampleCount)
     {
-        gain += gainStep;
-        buffer[i] *= gain;
+        return sampleCount + capacity - delay - length;
     }
+    return sampleCount - delay - length;
 }
 
-void CircularBuffer::applyFilterToSamples(size_t delay, size_t length,
-    Filter* filter)
+CircularBuffer::Window CircularBuffer::beginWrite(size_t numToAdd)
 {
-    size_t start = capacityMask(sampleCount - delay - length);
-    size_t numPreWrap = juce::jmin(length, buffer.size() - start);
-    size_t numPostWrap = length - numPreWrap;
+    // packed frames are written to the staging buffer first, and packed into
+    // the delay line by endWrite
+    if (isPacked())
+    {
+        jassert(numToAdd <= maxStagedFrames);
+        return { staging, numToAdd, staging, 0 };
+    }
+    return getRun(sampleCount, numToAdd);
+}
 
-    filter->processSamples(buffer.data() + start, numPreWrap);
-    filter->processSamples(buffer.data(), numPostWrap);
+void CircularBuffer::endWrite(const Window& run, size_t numToAdd)
+{
+    if (isPacked())
+    {
+        packFrames(sampleCount, run.samples, numToAdd);
+    }
+    sampleCount += numToAdd;
 }
 
-void CircularBuffer::clear()
+void CircularBuffer::writeBack(const Window& window, size_t delay,
+    size_t length)
 {
-    sampleCount = 0;
-    memset(buffer.data(), 0, buffer.size() * sizeof(float));
+    // the growth thread may be copying the frames the window came from
+    trackRewrite(delay, length);
+
+    // a window in float storage is the delay line itself, so the taps have
+    // already written to it
+    if (isPacked())
+    {
+        packFrames(getStartSample(delay, length), window.samples, length);
+    }
 }
 
-void CircularBuffer::resize(size_t newLength)
+void CircularBuffer::packFrames(size_t startSample, const float* frames,
+    size_t length)
 {
-    jassert(juce::isPowerOfTwo(newLength) && newLength >= 2);
-    buffer.resize(newLength);
-    clear();
+    Span span = getSpan(startSample, length);
+    size_t numPreWrap = span.numPreWrap;
+    size_t runs[2][3] = {
+        { span.segment, span.frame, numPreWrap },
+        { span.nextSegment, 0, length - numPreWrap }
+    };
+
+    for (size_t i = 0;i < 2;i++)
+    {
+        uint16_t* output = getPackedSamples(runs[i][0])
+            + runs[i][1] * numChannels;
+        const float* input = frames + (i == 0 ? 0 : numPreWrap) * numChannels;
+        size_t numSamples = runs[i][2] * numChannels;
+        if (storage == DelayStorage::half)
+        {
+            SampleKernels::floatToHalf(output, input, numSamples);
+        }
+        else
+        {
+            SampleKernels::floatToInt16Dithered(output, input, numSamples,
+                dither);
+        }
+    }
+}
+
+void CircularBuffer::unpackFrames(float* frames, size_t startSample,
+    size_t length)
+{
+    Span span = getSpan(startSample, length);
+    size_t numPreWrap = span.numPreWrap;
+    size_t runs[2][3] = {
+        { span.segment, span.frame, numPreWrap },
+        { span.nextSegment, 0, length - numPreWrap }
+    };
+
+    for (size_t i = 0;i < 2;i++)
+    {
+        const uint16_t* input = getPackedSamples(runs[i][0])
+            + runs[i][1] * numChannels;
+        float* output = frames + (i == 0 ? 0 : numPreWrap) * numChannels;
+        size_t numSamples = runs[i][2] * numChannels;
+        if (storage == DelayStorage::half)
+        {
+            SampleKernels::halfToFloat(output, input, numSamples);
+        }
+        else
+        {
+            SampleKernels::int16ToFloat(output, input, numSamples);
+        }
+    }
+}
+
+CircularBuffer::Span CircularBuffer::getSpan(size_t startSample,
+    size_t length)
+{
+    size_t position = startSample % capacity;
+    Span span;
+    span.segment = position / segmentLength;
+    span.frame = position % segmentLength;
+    span.nextSegment = (span.segment + 1) % segments.size();
+
+    if (segments.size() == 1 && segments[0]->isMirrored())
+    {
+        // the mapping past the end of the buffer is the start of the buffer
+        span.numPreWrap = length;
+    }
+    else
+    {
+        span.numPreWrap = juce::jmin(length, segmentLength - span.frame);
+    }
+    return span;
+}
+
+void CircularBuffer::zeroStaleFrames(const Window& window, size_t delay,
+    size_t length)
+{
+    // the oldest frames of the window are stale if they reach back past the
+    // last clear. A stale frame only ever holds silence, and every frame
+    // written since the clear is newer than it, so zeroing it again on a
+    // later read gives the same result as zeroing it once when cleared
+    if (delay + length <= sampleCount)
+    {
+        return;
+    }
+
+    size_t numStale = juce::jmin(length, delay + length - sampleCount);
+    size_t numPreWrap = juce::jmin(numStale, window.numPreWrap);
+    memset(window.samples, 0, numPreWrap * numChannels * sizeof(float));
+    memset(window.wrapped, 0,
+        (numStale - numPreWrap) * numChannels * sizeof(float));
+}
+
+CircularBuffer::Window CircularBuffer::getRun(size_t startSample,
+    size_t length)
+{
+    // a run that leaves its segment continues at the start of the next one
+    // (or of the same one, when the buffer is a single unmirrored segment)
+    Span span = getSpan(startSample, length);
+
+    Window run;
+    run.samples = segments[span.segment]->data() + span.frame * numChannels;
+    run.numPreWrap = span.numPreWrap;
+    run.wrapped = segments[span.nextSegment]->data();
+    run.numPostWrap = length - span.numPreWrap;
+
+    return run;
 }
 
-void CircularBuffer::resize(double sampleRate, float maxDelaySeconds)
+void CircularBuffer::processTapChannel(const Window& window, size_t channel,
+    size_t length, float startGain, float gainStep, TapOutput tap,
+    bool inPlace)
 {
-    int maxSamples = static_cast<int>(std::ceil(sampleRate * maxDelaySeconds));
-    size_t newLength = static_cast<size_t>(juce::nextPowerOfTwo(maxSamples));
-    resize(newLength);
+    float ampStep = (tap.endAmp - tap.startAmp) / static_cast<float>(length);
+    float preWrap = static_cast<float>(window.numPreWrap);
+
+    // the filter works on the samples in place and sums its output into the
+    // output buffer in the same pass, so each sample is only touched once
+    tap.filter->processTap(*tap.coefficients, window.samples + channel,
+        window.numPreWrap, numChannels, 0, startGain, gainStep, tap.output,
+        tap.startAmp, ampStep, inPlace);
+    tap.filter->processTap(*tap.coefficients, window.wrapped + channel,
+        window.numPostWrap, numChannels, window.numPreWrap,
+        startGain + gainStep * preWrap, gainStep,
+        tap.output + window.numPreWrap, tap.startAmp + ampStep * preWrap,
+        ampStep, inPlace);
 }
 
-size_t CircularBuffer::capacityMask(size_t sample)
+void CircularBuffer::processCascadedTapChannel(const Window& window,
+    size_t channel, size_t length, size_t numStages, float startGain,
+    float gainStep, TapOutput tap)
 {
-    return sample & (buffer.size() - 1);
+    float ampStep = (tap.endAmp - tap.startAmp) / static_cast<float>(length);
+    float preWrap = static_cast<float>(window.numPreWrap);
+
+    tap.filter->processCascade(*tap.coefficients, window.samples + channel,
+        window.numPreWrap, numChannels, 0, numStages, startGain, gainStep,
+        tap.output, tap.startAmp, ampStep);
+    tap.filter->processCascade(*tap.coefficients, window.wrapped + channel,
+        window.numPostWrap, numChannels, window.numPreWrap, numStages,
+        startGain + gainStep * preWrap, gainStep,
+        tap.output + window.numPreWrap, tap.startAmp + ampStep * preWrap,
+        ampStep);
 }
\ No newline at end of file
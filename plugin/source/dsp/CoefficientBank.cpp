@@ -0,0 +1,275 @@
+#include "CoefficientBank.h"
+
+CoefficientBank::CoefficientBank()
+    : designs(&coefficientTable->getDesigns(44100)),
+    engine(FilterEngine::biquad), maxSamples(0), highPass(nullptr),
+    lowPass(nullptr), mix(nullptr), mixStride(0), grainLength(1),
+    stateVariableHighPass(nullptr), stateVariableLowPass(nullptr),
+    stateVariableStride(0)
+{
+    highPassFreq.setCurrentAndTargetValue(20);
+    lowPassFreq.setCurrentAndTargetValue(20000);
+    smoothMix.setCurrentAndTargetValue(1);
+
+    updateCurrentCoefficients();
+}
+
+void CoefficientBank::setParameters
+(float highPassCutoff, float lowPassCutoff, float mixPercent)
+{
+    highPassFreq.setTargetValue(highPassCutoff);
+    lowPassFreq.setTargetValue(lowPassCutoff);
+    smoothMix.setTargetValue(mixPercent / 100);
+}
+
+void CoefficientBank::setEngine(FilterEngine newEngine)
+{
+    engine = newEngine;
+    updateCurrentCoefficients();
+}
+
+FilterEngine CoefficientBank::getEngine() const
+{
+    return engine;
+}
+
+void CoefficientBank::prepare(const juce::dsp::ProcessSpec& spec,
+    int rampLength)
+{
+    // the cutoffs glide over a host block rather than over one sub-block,
+    // which would make the ramp shorter whenever the host's blocks are split
+    highPassFreq.reset(rampLength);
+    lowPassFreq.reset(rampLength);
+    designs = &coefficientTable->getDesigns(spec.sampleRate);
+
+    maxSamples = juce::jmax((size_t) spec.maximumBlockSize, (size_t) 1);
+
+    // the sample rate may have changed, so look the filters up again for it
+    updateCurrentCoefficients();
+}
+
+void CoefficientBank::allocate(DspArena& arena, const juce::String& side)
+{
+    // in the order prepareBlock fills them in
+    size_t maxGrains = maxSamples / smoothGrain + 1;
+    highPass = arena.allocate<Biquad>(side + " high-pass biquads", maxGrains);
+    lowPass = arena.allocate<Biquad>(side + " low-pass biquads", maxGrains);
+    stateVariableHighPass = arena.allocate<StateVariable>(
+        side + " high-pass state variable", maxSamples);
+    stateVariableLowPass = arena.allocate<StateVariable>(
+        side + " low-pass state variable", maxSamples);
+    mix = arena.allocate<float>(side + " filter mix", maxSamples);
+}
+
+void CoefficientBank::prepareBlock(size_t numSamples)
+{
+    jassert(numSamples <= maxSamples);
+
+    if (engine == FilterEngine::stateVariable)
+    {
+        prepareStateVariableBlock(numSamples);
+    }
+    else
+    {
+        prepareBiquadBlock(numSamples);
+    }
+
+    if (smoothMix.isSmoothing())
+    {
+        for (size_t i = 0;i < numSamples;i++)
+        {
+            mix[i] = smoothMix.getNextValue();
+        }
+        mixStride = 1;
+    }
+    else
+    {
+        mix[0] = smoothMix.getCurrentValue();
+        mixStride = 0;
+    }
+}
+
+void CoefficientBank::prepareBiquadBlock(size_t numSamples)
+{
+    if (highPassFreq.isSmoothing() || lowPassFreq.isSmoothing())
+    {
+        // one set of coefficients per grain, as the cutoffs move
+        size_t grain = 0;
+        for (size_t start = 0;start < numSamples;start += smoothGrain)
+        {
+            int length = (int) juce::jmin(numSamples - start, smoothGrain);
+            if (highPassFreq.isSmoothing())
+            {
+                currentHighPass = makeHighPass(highPassFreq.skip(length));
+            }
+            if (lowPassFreq.isSmoothing())
+            {
+                currentLowPass = makeLowPass(lowPassFreq.skip(length));
+            }
+
+            highPass[grain] = currentHighPass;
+            lowPass[grain] = currentLowPass;
+            grain++;
+        }
+        grainLength = smoothGrain;
+    }
+    else
+    {
+        highPass[0] = currentHighPass;
+        lowPass[0] = currentLowPass;
+        grainLength = juce::jmax(numSamples, (size_t) 1);
+    }
+
+    // the other engine's coefficients only need to be right when the engine
+    // is switched, which updateCurrentCoefficients takes care of
+}
+
+void CoefficientBank::prepareStateVariableBlock(size_t numSamples)
+{
+    if (highPassFreq.isSmoothing() || lowPassFreq.isSmoothing())
+    {
+        // a new set of coefficients every sample, as the cutoffs move. They
+        // are only looked up once per grain and interpolated in between,
+        // which the state variable filters tolerate without any artifacts
+        for (size_t start = 0;start < numSamples;start += smoothGrain)
+        {
+            size_t length = juce::jmin(numSamples - start, smoothGrain);
+            StateVariable high = currentStateVariableHighPass;
+            StateVariable low = currentStateVariableLowPass;
+            if (highPassFreq.isSmoothing())
+            {
+                currentStateVariableHighPass = designs->getStateVariable(
+                    highPassFreq.skip((int) length));
+            }
+            if (lowPassFreq.isSmoothing())
+            {
+                currentStateVariableLowPass = designs->getStateVariable(
+                    lowPassFreq.skip((int) length));
+            }
+
+            interpolate(high, currentStateVariableHighPass,
+                stateVariableHighPass + start, length);
+            interpolate(low, currentStateVariableLowPass,
+                stateVariableLowPass + start, length);
+        }
+        stateVariableStride = 1;
+    }
+    else
+    {
+        stateVariableHighPass[0] = currentStateVariableHighPass;
+        stateVariableLowPass[0] = currentStateVariableLowPass;
+        stateVariableStride = 0;
+    }
+}
+
+void CoefficientBank::skipBlock(size_t numSamples)
+{
+    // keeps the smoothing in step with a bank whose coefficients are being
+    // used in place of this one's. The filter designs follow the cutoffs
+    // too, so they're right as soon as this bank is used again
+    bool cutoffsMoving = highPassFreq.isSmoothing()
+        || lowPassFreq.isSmoothing();
+    highPassFreq.skip((int) numSamples);
+    lowPassFreq.skip((int) numSamples);
+    smoothMix.skip((int) numSamples);
+    if (cutoffsMoving)
+    {
+        updateCurrentCoefficients();
+    }
+}
+
+bool CoefficientBank::matches(const CoefficientBank& other) const
+{
+    bool settled = !highPassFreq.isSmoothing() && !lowPassFreq.isSmoothing()
+        && !smoothMix.isSmoothing() && !other.highPassFreq.isSmoothing()
+        && !other.lowPassFreq.isSmoothing() && !other.smoothMix.isSmoothing();
+
+    return settled && juce::exactlyEqual(highPassFreq.getCurrentValue(),
+            other.highPassFreq.getCurrentValue())
+        && juce::exactlyEqual(lowPassFreq.getCurrentValue(),
+            other.lowPassFreq.getCurrentValue())
+        && juce::exactlyEqual(smoothMix.getCurrentValue(),
+            other.smoothMix.getCurrentValue());
+}
+
+size_t CoefficientBank::getGrainLength() const
+{
+    return grainLength;
+}
+
+const CoefficientBank::Biquad& CoefficientBank::getHighPass(size_t grain) const
+{
+    return highPass[grain];
+}
+
+const CoefficientBank::Biquad& CoefficientBank::getLowPass(size_t grain) const
+{
+    return lowPass[grain];
+}
+
+const float* CoefficientBank::getMix() const
+{
+    return mix;
+}
+
+size_t CoefficientBank::getMixStride() const
+{
+    return mixStride;
+}
+
+bool CoefficientBank::isFullyWet() const
+{
+    // the filters' output can be used as is, with no dry signal mixed in
+    return mixStride == 0 && juce::exactlyEqual(mix[0], 1.0f);
+}
+
+const CoefficientBank::StateVariable*
+CoefficientBank::getStateVariableHighPass() const
+{
+    return stateVariableHighPass;
+}
+
+const CoefficientBank::StateVariable*
+CoefficientBank::getStateVariableLowPass() const
+{
+    return stateVariableLowPass;
+}
+
+size_t CoefficientBank::getStateVariableStride() const
+{
+    return stateVariableStride;
+}
+
+void CoefficientBank::updateCurrentCoefficients()
+{
+    float high = highPassFreq.getCurrentValue();
+    float low = lowPassFreq.getCurrentValue();
+    currentHighPass = makeHighPass(high);
+    currentLowPass = makeLowPass(low);
+    currentStateVariableHighPass = designs->getStateVariable(high);
+    currentStateVariableLowPass = designs->getStateVariable(low);
+}
+
+CoefficientBank::Biquad CoefficientBank::makeHighPass(float freq) const
+{
+    return designs->getHighPass(freq);
+}
+
+CoefficientBank::Biquad CoefficientBank::makeLowPass(float freq) const
+{
+    return designs->getLowPass(freq);
+}
+
+void CoefficientBank::interpolate(const StateVariable& start,
+    const StateVariable& end, StateVariable* output, size_t length)
+{
+    // ends on the end coefficients, so the next grain carries on from them
+    float step = 1.0f / (float) length;
+    for (size_t i = 0;i < length;i++)
+    {
+        float amount = step * (float) (i + 1);
+        output[i].a1 = start.a1 + (end.a1 - start.a1) * amount;
+        output[i].a2 = start.a2 + (end.a2 - start.a2) * amount;
+        output[i].a3 = start.a3 + (end.a3 - start.a3) * amount;
+    }
+}
\ No newline at end of file
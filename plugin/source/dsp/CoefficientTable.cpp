@@ -0,0 +1,154 @@
+#include "CoefficientTable.h"
+#include <cstring>
+
+CoefficientTable::Designs::Designs(double rate) : sampleRate(rate)
+{
+    // one more point than needed, so the top of the last octave can still be
+    // interpolated towards something
+    size_t numOctaves = lastOctave - firstOctave + 1;
+    size_t numPoints = numOctaves * pointsPerOctave + 1;
+    highPass.resize(numPoints);
+    lowPass.resize(numPoints);
+    stateVariable.resize(numPoints);
+
+    // keep the designs below nyquist at low sample rates
+    double highestFreq = sampleRate * 0.49;
+    for (size_t i = 0;i < numPoints;i++)
+    {
+        size_t octave = i / pointsPerOctave;
+        double step = static_cast<double>(i % pointsPerOctave)
+            / pointsPerOctave;
+        double freq = std::ldexp(1 + step, firstOctave + (int) octave);
+        freq = juce::jmin(freq, highestFreq);
+
+        highPass[i] = designHighPass(sampleRate, freq);
+        lowPass[i] = designLowPass(sampleRate, freq);
+        stateVariable[i] = designStateVariable(sampleRate, freq);
+    }
+}
+
+double CoefficientTable::Designs::getSampleRate() const
+{
+    return sampleRate;
+}
+
+CoefficientTable::Biquad CoefficientTable::Designs::getHighPass(
+    float freq) const
+{
+    size_t index;
+    float amount = getPosition(freq, index);
+    return interpolate(highPass[index], highPass[index + 1], amount);
+}
+
+CoefficientTable::Biquad CoefficientTable::Designs::getLowPass(
+    float freq) const
+{
+    size_t index;
+    float amount = getPosition(freq, index);
+    return interpolate(lowPass[index], lowPass[index + 1], amount);
+}
+
+CoefficientTable::StateVariable CoefficientTable::Designs::getStateVariable(
+    float freq) const
+{
+    size_t index;
+    float amount = getPosition(freq, index);
+    const StateVariable& a = stateVariable[index];
+    const StateVariable& b = stateVariable[index + 1];
+
+    return {
+        a.a1 + (b.a1 - a.a1) * amount,
+        a.a2 + (b.a2 - a.a2) * amount,
+        a.a3 + (b.a3 - a.a3) * amount
+    };
+}
+
+float CoefficientTable::Designs::getPosition(float freq, size_t& index) const
+{
+    freq = juce::jlimit(minFreq, maxFreq, freq);
+
+    // the exponent picks the octave, and the mantissa (which is linear in
+    // frequency within an octave) picks the point within it
+    uint32_t bits;
+    memcpy(&bits, &freq, sizeof(bits));
+    int octave = static_cast<int>(bits >> 23) - 127 - firstOctave;
+    float mantissa = static_cast<float>(bits & 0x7fffff) / (1 << 23);
+
+    float position = mantissa * pointsPerOctave;
+    size_t point = static_cast<size_t>(position);
+    index = static_cast<size_t>(octave) * pointsPerOctave + point;
+    return position - static_cast<float>(point);
+}
+
+CoefficientTable::Biquad CoefficientTable::Designs::interpolate(
+    const Biquad& a, const Biquad& b, float amount)
+{
+    // stable designs stay stable when interpolated, since the region of
+    // stable a1 and a2 is convex
+    return {
+        a.b0 + (b.b0 - a.b0) * amount,
+        a.b1 + (b.b1 - a.b1) * amount,
+        a.b2 + (b.b2 - a.b2) * amount,
+        a.a1 + (b.a1 - a.a1) * amount,
+        a.a2 + (b.a2 - a.a2) * amount
+    };
+}
+
+const CoefficientTable::Designs& CoefficientTable::getDesigns(
+    double sampleRate)
+{
+    const juce::ScopedLock scopedLock(lock);
+    for (const std::unique_ptr<Designs>& table : designs)
+    {
+        if (juce::exactlyEqual(table->getSampleRate(), sampleRate))
+        {
+            return *table;
+        }
+    }
+
+    designs.push_back(std::make_unique<Designs>(sampleRate));
+    return *designs.back();
+}
+
+CoefficientTable::Biquad CoefficientTable::designHighPass(double sampleRate,
+    double freq)
+{
+    // the same design as juce::dsp::IIR::Coefficients::makeHighPass (with a
+    // Q of 1 / sqrt(2)), worked out in double precision
+    double n = std::tan(juce::MathConstants<double>::pi * freq / sampleRate);
+    double nSquared = n * n;
+    double invQ = juce::MathConstants<double>::sqrt2;
+    double c1 = 1 / (1 + invQ * n + nSquared);
+
+    return { (float) c1, (float) (c1 * -2), (float) c1,
+        (float) (c1 * 2 * (nSquared - 1)),
+        (float) (c1 * (1 - invQ * n + nSquared)) };
+}
+
+CoefficientTable::Biquad CoefficientTable::designLowPass(double sampleRate,
+    double freq)
+{
+    // the same design as juce::dsp::IIR::Coefficients::makeLowPass
+    double n = 1 / std::tan(juce::MathConstants<double>::pi * freq
+        / sampleRate);
+    double nSquared = n * n;
+    double invQ = juce::MathConstants<double>::sqrt2;
+    double c1 = 1 / (1 + invQ * n + nSquared);
+
+    return { (float) c1, (float) (c1 * 2), (float) c1,
+        (float) (c1 * 2 * (1 - nSquared)),
+        (float) (c1 * (1 - invQ * n + nSquared)) };
+}
+
+CoefficientTable::StateVariable CoefficientTable::designStateVariable(
+    double sampleRate, double freq)
+{
+    // as in Andrew Simper's "Linear Trapezoidal Integrated SVF" paper
+    double g = std::tan(juce::MathConstants<double>::pi * freq / sampleRate);
+    double k = stateVariableDamping;
+    double a1 = 1 / (1 + g * (g + k));
+    double a2 = g * a1;
+    double a3 = g * a2;
+
+    return { (float) a1, (float) a2, (float) a3 };
+}
\ No newline at end of file
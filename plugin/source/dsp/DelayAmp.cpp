@@ -1,37 +1,25 @@
 #include "DelayAmp.h"
+#include <juce_core/juce_core.h>
 
 DelayAmp::DelayAmp()
-    : lastValue(0), currentValue(0), tree(nullptr), parameterId("")
+    : lastValue(0), currentValue(0)
 { }
 
-DelayAmp::~DelayAmp()
+void DelayAmp::setValue(float target, float fraction)
 {
-    tree->removeParameterListener(parameterId, this);
-}
-
-void DelayAmp::listenTo
-(juce::AudioProcessorValueTreeState* stateTree, std::string param)
-{
-    stateTree->addParameterListener(param, this);
-    currentValue = *stateTree->getRawParameterValue(param);
-
-    if (tree == nullptr && parameterId.compare("") != 0)
+    if (fraction >= 1)
     {
-        tree->removeParameterListener(parameterId, this);
+        currentValue = target;
     }
     else
     {
-        lastValue = currentValue;
+        currentValue = lastValue + (target - lastValue) * fraction;
     }
-
-    tree = stateTree;
-    parameterId = param;
 }
 
-void DelayAmp::parameterChanged(const juce::String& param, float value)
+void DelayAmp::reset()
 {
-    juce::ignoreUnused(param);
-    currentValue = value;
+    lastValue = currentValue;
 }
 
 float DelayAmp::getLastValue()
@@ -0,0 +1,232 @@
+#include "DelayMemory.h"
+#include <cstdint>
+#include <juce_core/juce_core.h>
+#if JUCE_LINUX
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+DelayMemory::DelayMemory()
+    : samples(nullptr), length(0), mirrored(false), hugePages(false),
+    lockRequested(false), locked(false) { }
+
+DelayMemory::~DelayMemory()
+{
+    release();
+}
+
+void DelayMemory::allocate(std::size_t numSamples)
+{
+    release();
+
+    if (!allocateMirrored(numSamples))
+    {
+        fallback.resize(numSamples, 0.0f);
+        samples = fallback.data();
+    }
+    length = numSamples;
+
+    // faulting the mapping's pages in now keeps the page faults off the
+    // audio thread the first time each part of the buffer is touched (the
+    // vector's pages are faulted in as it zeroes them)
+    if (mirrored)
+    {
+        prefault();
+    }
+
+    if (lockRequested)
+    {
+        lock();
+    }
+}
+
+void DelayMemory::release()
+{
+    unlock();
+#if JUCE_LINUX
+    if (mirrored)
+    {
+        munmap(samples, length * sizeof(float) * 2);
+    }
+#endif
+    std::vector<float>().swap(fallback);
+    samples = nullptr;
+    length = 0;
+    mirrored = false;
+    hugePages = false;
+}
+
+void DelayMemory::setLocked(bool shouldLock)
+{
+    lockRequested = shouldLock;
+    if (shouldLock)
+    {
+        lock();
+    }
+    else
+    {
+        unlock();
+    }
+}
+
+bool DelayMemory::isLocked()
+{
+    return locked;
+}
+
+float* DelayMemory::data()
+{
+    return samples;
+}
+
+std::size_t DelayMemory::size()
+{
+    return length;
+}
+
+bool DelayMemory::isMirrored()
+{
+    return mirrored;
+}
+
+bool DelayMemory::usesHugePages()
+{
+    return hugePages;
+}
+
+bool DelayMemory::allocateMirrored(std::size_t numSamples)
+{
+#if JUCE_LINUX
+    std::size_t bytes = numSamples * sizeof(float);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (bytes == 0 || pageSize <= 0 || bytes % (std::size_t) pageSize != 0)
+    {
+        return false;
+    }
+
+    // huge pages only come from a pool the system has to have set aside,
+    // so ordinary pages are the fallback whenever that's empty
+    return (bytes % hugePageSize == 0 && mapMirrored(bytes, true))
+        || mapMirrored(bytes, false);
+#else
+    juce::ignoreUnused(numSamples);
+    return false;
+#endif
+}
+
+bool DelayMemory::mapMirrored(std::size_t bytes, bool huge)
+{
+#if JUCE_LINUX
+    unsigned int memfdFlags = MFD_CLOEXEC | (huge ? MFD_HUGETLB : 0u);
+    int fd = memfd_create("delay-intervals", memfdFlags);
+    if (fd < 0)
+    {
+        return false;
+    }
+    if (ftruncate(fd, (off_t) bytes) != 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    // reserve an address range twice the size of the buffer, then map the
+    // same file over both halves of it. The range starts on a huge page
+    // boundary, which huge pages need and transparent huge pages prefer, so
+    // a huge page's worth more is reserved and the ends trimmed off after
+    std::size_t reserved = bytes * 2 + hugePageSize;
+    void* reservation = mmap(nullptr, reserved, PROT_NONE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reservation == MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+
+    char* start = static_cast<char*>(reservation);
+    uintptr_t address = reinterpret_cast<uintptr_t>(start);
+    std::size_t lead = (hugePageSize - address % hugePageSize) % hugePageSize;
+    char* first = start + lead;
+    if (lead > 0)
+    {
+        munmap(start, lead);
+    }
+    munmap(first + bytes * 2, reserved - lead - bytes * 2);
+
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_FIXED;
+    void* lower = mmap(first, bytes, prot, flags, fd, 0);
+    void* upper = mmap(first + bytes, bytes, prot, flags, fd, 0);
+    close(fd); // the mappings keep the memory alive
+
+    if (lower == MAP_FAILED || upper == MAP_FAILED)
+    {
+        munmap(first, bytes * 2);
+        return false;
+    }
+
+    if (!huge)
+    {
+        // only honoured where shared memory may use transparent huge pages
+        madvise(first, bytes * 2, MADV_HUGEPAGE);
+    }
+
+    samples = reinterpret_cast<float*>(first);
+    mirrored = true;
+    hugePages = huge;
+    return true;
+#else
+    juce::ignoreUnused(bytes, huge);
+    return false;
+#endif
+}
+
+std::size_t DelayMemory::getMappedBytes()
+{
+    return length * sizeof(float) * (mirrored ? 2 : 1);
+}
+
+void DelayMemory::prefault()
+{
+#if JUCE_LINUX
+    // both halves of the mapping need their own page table entries, even
+    // though they share the same memory
+    std::size_t bytes = getMappedBytes();
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(samples, bytes, MADV_POPULATE_WRITE) == 0)
+    {
+        return;
+    }
+#endif
+    // older kernels: write to every page instead (the memory is all zeroes,
+    // so writing a zero changes nothing)
+    std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+    volatile char* bytePointer = reinterpret_cast<volatile char*>(samples);
+    for (std::size_t offset = 0;offset < bytes;offset += pageSize)
+    {
+        bytePointer[offset] = 0;
+    }
+#endif
+}
+
+void DelayMemory::lock()
+{
+#if JUCE_LINUX
+    // mlock fails when it would go over RLIMIT_MEMLOCK, in which case the
+    // memory is simply left unlocked
+    if (!locked && samples != nullptr)
+    {
+        locked = mlock(samples, getMappedBytes()) == 0;
+    }
+#endif
+}
+
+void DelayMemory::unlock()
+{
+#if JUCE_LINUX
+    if (locked)
+    {
+        munlock(samples, getMappedBytes());
+        locked = false;
+    }
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+#include "DspArena.h"
+#include <cstring>
+#include <new>
+
+DspArena::DspArena()
+    : memory(nullptr), size(0), nextBlock(0), planning(false) { }
+
+DspArena::~DspArena()
+{
+    release();
+}
+
+void DspArena::plan()
+{
+    release();
+    blocks.clear();
+    planning = true;
+}
+
+void DspArena::commit()
+{
+    jassert(planning);
+    planning = false;
+    nextBlock = 0;
+
+    if (size > 0)
+    {
+        memory = static_cast<unsigned char*>(::operator new(size,
+            std::align_val_t(alignment)));
+        memset(memory, 0, size);
+    }
+}
+
+void* DspArena::allocateBytes(const juce::String& name, size_t bytes)
+{
+    if (planning)
+    {
+        size_t offset = size;
+        size = (offset + bytes + alignment - 1) / alignment * alignment;
+        blocks.push_back({ name, offset, bytes });
+        return nullptr;
+    }
+
+    // the blocks must be asked for exactly as they were while planning
+    jassert(nextBlock < blocks.size());
+    const Block& block = blocks[nextBlock++];
+    jassert(block.name == name && block.bytes == bytes);
+    juce::ignoreUnused(name, bytes);
+    return block.bytes > 0 ? memory + block.offset : nullptr;
+}
+
+size_t DspArena::getSize() const
+{
+    return size;
+}
+
+juce::String DspArena::getMemoryMap() const
+{
+    juce::String map = "DSP arena: " + juce::String(size) + " bytes in "
+        + juce::String(blocks.size()) + " blocks\n";
+    for (const Block& block : blocks)
+    {
+        // offset (hex), size in bytes, name
+        juce::String offset = juce::String::toHexString(block.offset);
+        juce::String bytes(block.bytes);
+        map += "  0x" + offset.paddedLeft('0', 6) + "  "
+            + bytes.paddedLeft(' ', 7) + "  " + block.name + "\n";
+    }
+    return map;
+}
+
+void DspArena::release()
+{
+    if (memory != nullptr)
+    {
+        ::operator delete(memory, std::align_val_t(alignment));
+        memory = nullptr;
+    }
+    size = 0;
+}
\ No newline at end of file
@@ -1,164 +1,590 @@
 #include "Filter.h"
-typedef juce::dsp::IIR::Coefficients<float> Coefficients; 
+#include <cmath>
+#include "SampleKernels.h"
 
-Filter::Filter() : Filter(44100, 20, 20000) { }
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define FILTER_SSE 1
+#include <immintrin.h>
+#else
+#define FILTER_SSE 0
+#endif
 
-Filter::Filter(double sampleRate, float low, float high) 
-    : lastSampleRate(sampleRate), tempBuffer(128)
+#if FILTER_SSE
+// Spreads the left and right sets of state variable coefficients across the
+// lanes of a lock-step group, as [left, right, left, right]
+static inline void loadStateVariableLanes(
+    const CoefficientBank::StateVariable& left,
+    const CoefficientBank::StateVariable& right, __m128& a1, __m128& a2,
+    __m128& a3)
 {
-    setHighPassFrequency(low);
-    setLowPassFrequency(high);
+    __m128 l = _mm_load_ps(&left.a1);
+    __m128 r = _mm_load_ps(&right.a1);
+    __m128 low = _mm_unpacklo_ps(l, r);
+    __m128 high = _mm_unpackhi_ps(l, r);
+    a1 = _mm_movelh_ps(low, low);
+    a2 = _mm_movehl_ps(low, low);
+    a3 = _mm_movelh_ps(high, high);
+}
+#endif
 
-    highPassFreq.setCurrentAndTargetValue(low);
-    lowPassFreq.setCurrentAndTargetValue(high);
-    smoothMix.setCurrentAndTargetValue(1);
+Filter::Filter()
+{
+    reset();
 }
 
-Filter::~Filter()
+void Filter::reset()
 {
-    tree->removeParameterListener(highPassParam, this);
-    tree->removeParameterListener(lowPassParam, this);
-    tree->removeParameterListener(mixParam, this);
+    highPass = { 0, 0 };
+    lowPass = { 0, 0 };
+    for (Stage& stage : stages)
+    {
+        stage = { { 0, 0 }, { 0, 0 } };
+    }
 }
 
-void Filter::attachToParameters(juce::AudioProcessorValueTreeState* state,
-    const std::string& highPassParamId, const std::string& lowPassParamId,
-    const std::string& mixParamId)
+void Filter::processTap(const CoefficientBank& coefficients, float* samples,
+    size_t length, size_t stride, size_t offset, float gain, float gainStep,
+    float* output, float amp, float ampStep, bool inPlace)
 {
-    if (highPassParam.compare("") != 0)
+    // whether a tap writes back and whether it's mixed are the same for
+    // every sample of it, so they stay as branches (loops specialised on
+    // them measured no faster)
+    if (coefficients.getEngine() == FilterEngine::stateVariable)
     {
-        tree->removeParameterListener(highPassParam, this);
+        processStateVariableRange(coefficients, samples, length, stride,
+            offset, gain, gainStep, output, amp, ampStep, inPlace);
+        snapStatesToZero(0);
+        return;
     }
-    if (lowPassParam.compare("") != 0)
+
+    // offset is where these samples start within the block, which decides
+    // the grain (and so the coefficients) each of them falls in
+    size_t grainLength = coefficients.getGrainLength();
+    size_t end = offset + length;
+    size_t position = offset;
+    while (position < end)
     {
-        tree->removeParameterListener(lowPassParam, this);
+        size_t grain = position / grainLength;
+        size_t grainEnd = juce::jmin(end, (grain + 1) * grainLength);
+        size_t processed = position - offset;
+
+        processTapRange(coefficients.getHighPass(grain),
+            coefficients.getLowPass(grain), getMix(coefficients, position),
+            samples + processed * stride, grainEnd - position, stride, gain,
+            gainStep, output + processed, amp, ampStep, inPlace);
+        position = grainEnd;
     }
-    if (mixParam.compare("") != 0)
+    snapStatesToZero(0);
+}
+
+void Filter::processTaps(const CoefficientBank& leftCoefficients,
+    const CoefficientBank& rightCoefficients, InterleavedTap* taps,
+    size_t numTaps, size_t length, float gain, float gainStep,
+    float* leftOutput, float* rightOutput)
+{
+    // the taps' windows can't overlap, so every tap's samples can be worked
+    // through at once: each SSE register holds both channels of two taps,
+    // and working on two registers at a time hides the filters' latency
+    jassert(leftCoefficients.getEngine() == rightCoefficients.getEngine());
+    size_t tap = 0;
+#if FILTER_SSE
+    if (leftCoefficients.getEngine() == FilterEngine::stateVariable)
     {
-        tree->removeParameterListener(mixParam, this);
+        for (;tap + 4 <= numTaps;tap += 4)
+        {
+            processTapLanes<FilterEngine::stateVariable, 2>(leftCoefficients,
+                rightCoefficients, taps + tap, length, gain, gainStep,
+                leftOutput, rightOutput);
+        }
+        for (;tap + 2 <= numTaps;tap += 2)
+        {
+            processTapLanes<FilterEngine::stateVariable, 1>(leftCoefficients,
+                rightCoefficients, taps + tap, length, gain, gainStep,
+                leftOutput, rightOutput);
+        }
     }
+    else
+    {
+        for (;tap + 4 <= numTaps;tap += 4)
+        {
+            processTapLanes<FilterEngine::biquad, 2>(leftCoefficients,
+                rightCoefficients, taps + tap, length, gain, gainStep,
+                leftOutput, rightOutput);
+        }
+        for (;tap + 2 <= numTaps;tap += 2)
+        {
+            processTapLanes<FilterEngine::biquad, 1>(leftCoefficients,
+                rightCoefficients, taps + tap, length, gain, gainStep,
+                leftOutput, rightOutput);
+        }
+    }
+#endif
+    for (;tap < numTaps;tap++)
+    {
+        InterleavedTap& t = taps[tap];
+        t.left->processTap(leftCoefficients, t.frames, length, 2, 0, gain,
+            gainStep, leftOutput, t.leftAmp, t.leftAmpStep);
+        t.right->processTap(rightCoefficients, t.frames + 1, length, 2, 0,
+            gain, gainStep, rightOutput, t.rightAmp, t.rightAmpStep);
+    }
+}
 
-    state->addParameterListener(highPassParamId, this);
-    state->addParameterListener(lowPassParamId, this);
-    state->addParameterListener(mixParamId, this);
+#if FILTER_SSE
+template <FilterEngine engine, size_t numRegisters>
+void Filter::processTapLanes(const CoefficientBank& leftCoefficients,
+    const CoefficientBank& rightCoefficients, InterleavedTap* taps,
+    size_t length, float gain, float gainStep, float* leftOutput,
+    float* rightOutput)
+{
+    // register r holds (left, right) of tap 2r followed by (left, right) of
+    // tap 2r + 1, which is the order the frames are stored in
+    Filter* filters[numRegisters][4];
+    __m128 lowS1[numRegisters];
+    __m128 lowS2[numRegisters];
+    __m128 highS1[numRegisters];
+    __m128 highS2[numRegisters];
+    __m128 amp[numRegisters];
+    __m128 ampStep[numRegisters];
+    for (size_t r = 0;r < numRegisters;r++)
+    {
+        const InterleavedTap& a = taps[2 * r];
+        const InterleavedTap& b = taps[2 * r + 1];
+        Filter** f = filters[r];
+        f[0] = a.left;
+        f[1] = a.right;
+        f[2] = b.left;
+        f[3] = b.right;
 
-    highPassFreq.setTargetValue(*state->getRawParameterValue(highPassParamId));
-    lowPassFreq.setTargetValue(*state->getRawParameterValue(lowPassParamId));
-    smoothMix.setTargetValue(*state->getRawParameterValue(mixParamId) / 100);
+        lowS1[r] = _mm_setr_ps(f[0]->lowPass.s1, f[1]->lowPass.s1,
+            f[2]->lowPass.s1, f[3]->lowPass.s1);
+        lowS2[r] = _mm_setr_ps(f[0]->lowPass.s2, f[1]->lowPass.s2,
+            f[2]->lowPass.s2, f[3]->lowPass.s2);
+        highS1[r] = _mm_setr_ps(f[0]->highPass.s1, f[1]->highPass.s1,
+            f[2]->highPass.s1, f[3]->highPass.s1);
+        highS2[r] = _mm_setr_ps(f[0]->highPass.s2, f[1]->highPass.s2,
+            f[2]->highPass.s2, f[3]->highPass.s2);
+        amp[r] = _mm_setr_ps(a.leftAmp, a.rightAmp, b.leftAmp, b.rightAmp);
+        ampStep[r] = _mm_setr_ps(a.leftAmpStep, a.rightAmpStep,
+            b.leftAmpStep, b.rightAmpStep);
+    }
+
+    size_t leftGrainLength = leftCoefficients.getGrainLength();
+    size_t rightGrainLength = rightCoefficients.getGrainLength();
+    Mix leftMix = getMix(leftCoefficients, 0);
+    Mix rightMix = getMix(rightCoefficients, 0);
+    bool fullyWet = leftMix.fullyWet && rightMix.fullyWet;
+    bool mixMoving = leftMix.stride != 0 || rightMix.stride != 0;
+    const __m128 one = _mm_set1_ps(1);
+    const __m128 two = _mm_set1_ps(2);
+    const __m128 k = _mm_set1_ps(CoefficientTable::stateVariableDamping);
+
+    // the state variable coefficients can change every sample, so while
+    // either side's cutoffs move they're read inside the sample loop rather
+    // than once per grain
+    const CoefficientBank::StateVariable* leftLowCoefficients
+        = leftCoefficients.getStateVariableLowPass();
+    const CoefficientBank::StateVariable* rightLowCoefficients
+        = rightCoefficients.getStateVariableLowPass();
+    const CoefficientBank::StateVariable* leftHighCoefficients
+        = leftCoefficients.getStateVariableHighPass();
+    const CoefficientBank::StateVariable* rightHighCoefficients
+        = rightCoefficients.getStateVariableHighPass();
+    size_t leftStride = leftCoefficients.getStateVariableStride();
+    size_t rightStride = rightCoefficients.getStateVariableStride();
+    bool moving = leftStride != 0 || rightStride != 0;
+
+    __m128 mix = _mm_setr_ps(leftMix.values[0], rightMix.values[0],
+        leftMix.values[0], rightMix.values[0]);
+    __m128 dryMix = _mm_sub_ps(one, mix);
+    __m128 lb0, lb1, lb2, la1, la2, la3, hb0, hb1, hb2, ha1, ha2, ha3;
+    if constexpr (engine == FilterEngine::stateVariable)
+    {
+        loadStateVariableLanes(*leftLowCoefficients, *rightLowCoefficients,
+            la1, la2, la3);
+        loadStateVariableLanes(*leftHighCoefficients, *rightHighCoefficients,
+            ha1, ha2, ha3);
+    }
+    size_t position = 0;
+    while (position < length)
+    {
+        size_t grainEnd = length;
+        if constexpr (engine == FilterEngine::biquad)
+        {
+            size_t leftGrain = position / leftGrainLength;
+            size_t rightGrain = position / rightGrainLength;
+            grainEnd = juce::jmin(length, (leftGrain + 1) * leftGrainLength,
+                (rightGrain + 1) * rightGrainLength);
+
+            const CoefficientBank::Biquad& ll = leftCoefficients.getLowPass(
+                leftGrain);
+            const CoefficientBank::Biquad& rl = rightCoefficients.getLowPass(
+                rightGrain);
+            const CoefficientBank::Biquad& lh = leftCoefficients.getHighPass(
+                leftGrain);
+            const CoefficientBank::Biquad& rh = rightCoefficients.getHighPass(
+                rightGrain);
+            lb0 = _mm_setr_ps(ll.b0, rl.b0, ll.b0, rl.b0);
+            lb1 = _mm_setr_ps(ll.b1, rl.b1, ll.b1, rl.b1);
+            lb2 = _mm_setr_ps(ll.b2, rl.b2, ll.b2, rl.b2);
+            la1 = _mm_setr_ps(ll.a1, rl.a1, ll.a1, rl.a1);
+            la2 = _mm_setr_ps(ll.a2, rl.a2, ll.a2, rl.a2);
+            hb0 = _mm_setr_ps(lh.b0, rh.b0, lh.b0, rh.b0);
+            hb1 = _mm_setr_ps(lh.b1, rh.b1, lh.b1, rh.b1);
+            hb2 = _mm_setr_ps(lh.b2, rh.b2, lh.b2, rh.b2);
+            ha1 = _mm_setr_ps(lh.a1, rh.a1, lh.a1, rh.a1);
+            ha2 = _mm_setr_ps(lh.a2, rh.a2, lh.a2, rh.a2);
+        }
+
+        for (size_t i = position;i < grainEnd;i++)
+        {
+            if constexpr (engine == FilterEngine::stateVariable)
+            {
+                if (moving)
+                {
+                    loadStateVariableLanes(leftLowCoefficients[i * leftStride],
+                        rightLowCoefficients[i * rightStride], la1, la2, la3);
+                    loadStateVariableLanes(
+                        leftHighCoefficients[i * leftStride],
+                        rightHighCoefficients[i * rightStride], ha1, ha2,
+                        ha3);
+                }
+            }
+
+            gain += gainStep;
+            __m128 g = _mm_set1_ps(gain);
+            if (mixMoving)
+            {
+                float left = leftMix.values[i * leftMix.stride];
+                float right = rightMix.values[i * rightMix.stride];
+                mix = _mm_setr_ps(left, right, left, right);
+                dryMix = _mm_sub_ps(one, mix);
+            }
+            __m128 sum = _mm_setzero_ps();
+
+            for (size_t r = 0;r < numRegisters;r++)
+            {
+                __m64* a = (__m64*) (taps[2 * r].frames + i * 2);
+                __m64* b = (__m64*) (taps[2 * r + 1].frames + i * 2);
+                __m128 x = _mm_loadh_pi(_mm_loadl_pi(_mm_setzero_ps(), a), b);
+                __m128 dry = _mm_mul_ps(x, g);
+                __m128 low;
+                __m128 wet;
+
+                if constexpr (engine == FilterEngine::biquad)
+                {
+                    low = _mm_add_ps(_mm_mul_ps(lb0, dry), lowS1[r]);
+                    lowS1[r] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(lb1, dry),
+                        _mm_mul_ps(la1, low)), lowS2[r]);
+                    lowS2[r] = _mm_sub_ps(_mm_mul_ps(lb2, dry),
+                        _mm_mul_ps(la2, low));
 
-    tree = state;
-    highPassParam = highPassParamId;
-    lowPassParam = lowPassParamId;
-    mixParam = mixParamId;
+                    wet = _mm_add_ps(_mm_mul_ps(hb0, low), highS1[r]);
+                    highS1[r] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(hb1, low),
+                        _mm_mul_ps(ha1, wet)), highS2[r]);
+                    highS2[r] = _mm_sub_ps(_mm_mul_ps(hb2, low),
+                        _mm_mul_ps(ha2, wet));
+                }
+                else
+                {
+                    __m128 v3 = _mm_sub_ps(dry, lowS2[r]);
+                    __m128 v1 = _mm_add_ps(_mm_mul_ps(la1, lowS1[r]),
+                        _mm_mul_ps(la2, v3));
+                    __m128 v2 = _mm_add_ps(_mm_add_ps(lowS2[r],
+                        _mm_mul_ps(la2, lowS1[r])), _mm_mul_ps(la3, v3));
+                    lowS1[r] = _mm_sub_ps(_mm_mul_ps(two, v1), lowS1[r]);
+                    lowS2[r] = _mm_sub_ps(_mm_mul_ps(two, v2), lowS2[r]);
+                    low = v2;
+
+                    v3 = _mm_sub_ps(low, highS2[r]);
+                    v1 = _mm_add_ps(_mm_mul_ps(ha1, highS1[r]),
+                        _mm_mul_ps(ha2, v3));
+                    v2 = _mm_add_ps(_mm_add_ps(highS2[r],
+                        _mm_mul_ps(ha2, highS1[r])), _mm_mul_ps(ha3, v3));
+                    highS1[r] = _mm_sub_ps(_mm_mul_ps(two, v1), highS1[r]);
+                    highS2[r] = _mm_sub_ps(_mm_mul_ps(two, v2), highS2[r]);
+                    wet = _mm_sub_ps(_mm_sub_ps(low, _mm_mul_ps(k, v1)), v2);
+                }
+
+                __m128 result = wet;
+                if (!fullyWet)
+                {
+                    result = _mm_add_ps(_mm_mul_ps(wet, mix),
+                        _mm_mul_ps(dry, dryMix));
+                }
+                _mm_storel_pi(a, result);
+                _mm_storeh_pi(b, result);
+
+                amp[r] = _mm_add_ps(amp[r], ampStep[r]);
+                sum = _mm_add_ps(sum, _mm_mul_ps(result, amp[r]));
+            }
+
+            // fold the two taps together, leaving left in lane 0 and right
+            // in lane 1
+            __m128 folded = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+            leftOutput[i] += _mm_cvtss_f32(folded);
+            rightOutput[i] += _mm_cvtss_f32(
+                _mm_shuffle_ps(folded, folded, _MM_SHUFFLE(1, 1, 1, 1)));
+        }
+        position = grainEnd;
+    }
+
+    for (size_t r = 0;r < numRegisters;r++)
+    {
+        float state[4][4];
+        _mm_storeu_ps(state[0], lowS1[r]);
+        _mm_storeu_ps(state[1], lowS2[r]);
+        _mm_storeu_ps(state[2], highS1[r]);
+        _mm_storeu_ps(state[3], highS2[r]);
+        for (size_t lane = 0;lane < 4;lane++)
+        {
+            filters[r][lane]->lowPass = { state[0][lane], state[1][lane] };
+            filters[r][lane]->highPass = { state[2][lane], state[3][lane] };
+            filters[r][lane]->snapStatesToZero(0);
+        }
+    }
 }
+#endif
 
-void Filter::parameterChanged(const juce::String& param, float value)
+void Filter::snapStatesToZero(size_t numStages)
 {
-    if (param.compare(highPassParam) == 0)
+    // once a tap falls silent its filters' states decay towards zero, and
+    // would otherwise spend a long time in the subnormal range on the way
+    snapToZero(highPass);
+    snapToZero(lowPass);
+    for (size_t i = 0;i < numStages;i++)
     {
-        highPassFreq.setTargetValue(value);
+        snapToZero(stages[i].highPass);
+        snapToZero(stages[i].lowPass);
     }
-    else if (param.compare(lowPassParam) == 0)
+}
+
+void Filter::snapToZero(State& state)
+{
+    const float threshold = SampleKernels::snapThreshold;
+    if (!(state.s1 < -threshold || state.s1 > threshold))
     {
-        lowPassFreq.setTargetValue(value);
+        state.s1 = 0;
     }
-    else if (param.compare(mixParam) == 0)
+    if (!(state.s2 < -threshold || state.s2 > threshold))
     {
-        smoothMix.setTargetValue(value / 100);
+        state.s2 = 0;
     }
 }
 
-void Filter::reset()
+Filter::Mix Filter::getMix(const CoefficientBank& coefficients,
+    size_t offset)
 {
-    highPass.reset();
-    lowPass.reset();
+    size_t stride = coefficients.getMixStride();
+    return { coefficients.getMix() + offset * stride, stride,
+        coefficients.isFullyWet() };
 }
 
-void Filter::prepare(const juce::dsp::ProcessSpec& spec)
+float Filter::applyMix(const Mix& mix, size_t i, float wet, float dry)
 {
-    highPass.prepare(spec);
-    lowPass.prepare(spec);
-
-    highPassFreq.reset((int) spec.maximumBlockSize);
-    lowPassFreq.reset((int) spec.maximumBlockSize);
-    tempBuffer.resize(spec.maximumBlockSize);
+    if (mix.fullyWet)
+    {
+        return wet;
+    }
 
-    lastSampleRate = spec.sampleRate;
+    float amount = mix.values[i * mix.stride];
+    return (wet * amount) + (dry * (1 - amount));
 }
 
-float Filter::processSample(float sample)
+void Filter::processTapRange(const CoefficientBank::Biquad& hp,
+    const CoefficientBank::Biquad& lp, Mix mix, float* samples,
+    size_t length, size_t stride, float& gain, float gainStep, float* output,
+    float& amp, float ampStep, bool inPlace)
 {
-    if (highPassFreq.isSmoothing())
+    State high = highPass;
+    State low = lowPass;
+
+    // gain, filter, mix, write back and sum into the output in a single pass
+    // (a tap that isn't in place only reads the samples)
+    for (size_t i = 0;i < length;i++)
     {
-        setHighPassFrequency(highPassFreq.getNextValue());
+        gain += gainStep;
+        amp += ampStep;
+
+        float& sample = samples[i * stride];
+        float dry = sample * gain;
+        float wet = filterSample(hp, lp, high, low, dry);
+
+        float result = applyMix(mix, i, wet, dry);
+        if (inPlace)
+        {
+            sample = result;
+        }
+        output[i] += result * amp;
     }
-    if (lowPassFreq.isSmoothing())
+
+    highPass = high;
+    lowPass = low;
+}
+
+void Filter::processStateVariableRange(const CoefficientBank& coefficients,
+    float* samples, size_t length, size_t stride, size_t offset, float& gain,
+    float gainStep, float* output, float& amp, float ampStep, bool inPlace)
+{
+    // the coefficients are indexed by sample, with a stride of zero when the
+    // cutoffs aren't moving
+    size_t coefficientStride = coefficients.getStateVariableStride();
+    const CoefficientBank::StateVariable* lowCoefficients
+        = coefficients.getStateVariableLowPass() + offset * coefficientStride;
+    const CoefficientBank::StateVariable* highCoefficients
+        = coefficients.getStateVariableHighPass() + offset * coefficientStride;
+    Mix mix = getMix(coefficients, offset);
+
+    State high = highPass;
+    State low = lowPass;
+
+    for (size_t i = 0;i < length;i++)
     {
-        setLowPassFrequency(lowPassFreq.getNextValue());
+        gain += gainStep;
+        amp += ampStep;
+
+        float& sample = samples[i * stride];
+        float dry = sample * gain;
+
+        const CoefficientBank::StateVariable& lp
+            = lowCoefficients[i * coefficientStride];
+        const CoefficientBank::StateVariable& hp
+            = highCoefficients[i * coefficientStride];
+        float wet = filterSample(hp, lp, high, low, dry);
+
+        float result = applyMix(mix, i, wet, dry);
+        if (inPlace)
+        {
+            sample = result;
+        }
+        output[i] += result * amp;
     }
 
-    float wet = lowPass.processSample(highPass.processSample(sample));
-    float mix = smoothMix.getNextValue();
-    return (sample * (1 - mix)) + (wet * mix);
+    highPass = high;
+    lowPass = low;
 }
 
-void Filter::processSamples(float* samples, size_t length)
+void Filter::processCascade(const CoefficientBank& coefficients,
+    const float* samples, size_t length, size_t stride, size_t offset,
+    size_t numStages, float gain, float gainStep, float* output, float amp,
+    float ampStep)
 {
-    if (length == 0)
+    jassert(numStages <= maxCascadeStages);
+
+    if (coefficients.getEngine() == FilterEngine::stateVariable)
     {
+        size_t coefficientStride = coefficients.getStateVariableStride();
+        size_t index = offset * coefficientStride;
+        processCascadeRange(coefficients.getStateVariableHighPass() + index,
+            coefficients.getStateVariableLowPass() + index, coefficientStride,
+            getMix(coefficients, offset), samples, length, stride, numStages,
+            gain, gainStep, output, amp, ampStep);
+        snapStatesToZero(numStages);
         return;
     }
 
-    // copy the dry signal to the temporary buffer (for mixing)
-    memcpy(tempBuffer.data(), samples, length * sizeof(float));
-    
-    if (highPassFreq.isSmoothing() || lowPassFreq.isSmoothing())
+    // the biquads hold their coefficients for a grain, as in processTap
+    size_t grainLength = coefficients.getGrainLength();
+    size_t end = offset + length;
+    size_t position = offset;
+    while (position < end)
     {
-        size_t processed = 0;
-        while (processed < length)
+        size_t grain = position / grainLength;
+        size_t grainEnd = juce::jmin(end, (grain + 1) * grainLength);
+        size_t processed = position - offset;
+
+        processCascadeRange(&coefficients.getHighPass(grain),
+            &coefficients.getLowPass(grain), 0,
+            getMix(coefficients, position), samples + processed * stride,
+            grainEnd - position, stride, numStages, gain, gainStep,
+            output + processed, amp, ampStep);
+        position = grainEnd;
+    }
+    snapStatesToZero(numStages);
+}
+
+size_t Filter::countSubnormals() const
+{
+    size_t count = 0;
+    auto countState = [&count] (const State& state)
+    {
+        for (float value : { state.s1, state.s2 })
         {
-            size_t blockLen = juce::jmin(length - processed, smoothGrain);
-            float* ptr = samples + processed;
-            juce::dsp::AudioBlock<float> block(&ptr, 1, blockLen);
-            juce::dsp::ProcessContextReplacing<float> context(block);
-            
-            if (highPassFreq.isSmoothing())
-            {
-                setHighPassFrequency(highPassFreq.skip((int) blockLen));
-            }
-            if (lowPassFreq.isSmoothing())
+            if (std::fpclassify(value) == FP_SUBNORMAL)
             {
-                setLowPassFrequency(lowPassFreq.skip((int) blockLen));
+                count++;
             }
-            
-            lowPass.process(context);
-            highPass.process(context);
-            processed += blockLen;
         }
-    }
-    else
-    {
-        juce::dsp::AudioBlock<float> block(&samples, 1, length);
-        juce::dsp::ProcessContextReplacing<float> context(block);
+    };
 
-        lowPass.process(context);
-        highPass.process(context);
+    countState(highPass);
+    countState(lowPass);
+    for (const Stage& stage : stages)
+    {
+        countState(stage.highPass);
+        countState(stage.lowPass);
     }
+    return count;
+}
 
-    // mix the dry and wet signal
+template <typename Coefficients>
+void Filter::processCascadeRange(const Coefficients* highPassCoefficients,
+    const Coefficients* lowPassCoefficients, size_t coefficientStride,
+    Mix mix, const float* samples, size_t length, size_t stride,
+    size_t numStages, float& gain, float gainStep, float* output, float& amp,
+    float ampStep)
+{
+    // each sample runs through every stage before the next one is read, so
+    // the samples themselves are never written
     for (size_t i = 0;i < length;i++)
     {
-        float mix = smoothMix.getNextValue();
-        samples[i] = (samples[i] * mix) + (tempBuffer[i] * (1 - mix));
+        gain += gainStep;
+        amp += ampStep;
+        float sample = samples[i * stride] * gain;
+
+        const Coefficients& hp = highPassCoefficients[i * coefficientStride];
+        const Coefficients& lp = lowPassCoefficients[i * coefficientStride];
+        for (size_t n = 0;n < numStages;n++)
+        {
+            Stage& stage = stages[n];
+            float wet = filterSample(hp, lp, stage.highPass, stage.lowPass,
+                sample);
+            sample = applyMix(mix, i, wet, sample);
+        }
+
+        output[i] += sample * amp;
     }
 }
 
-void Filter::setHighPassFrequency(float freq)
+float Filter::filterSample(const CoefficientBank::Biquad& hp,
+    const CoefficientBank::Biquad& lp, State& high, State& low, float sample)
 {
-    highPass.coefficients = Coefficients::makeHighPass(lastSampleRate, freq);
+    float lowPassed = lp.b0 * sample + low.s1;
+    low.s1 = lp.b1 * sample - lp.a1 * lowPassed + low.s2;
+    low.s2 = lp.b2 * sample - lp.a2 * lowPassed;
+
+    float highPassed = hp.b0 * lowPassed + high.s1;
+    high.s1 = hp.b1 * lowPassed - hp.a1 * highPassed + high.s2;
+    high.s2 = hp.b2 * lowPassed - hp.a2 * highPassed;
+    return highPassed;
 }
 
-void Filter::setLowPassFrequency(float freq)
+float Filter::filterSample(const CoefficientBank::StateVariable& hp,
+    const CoefficientBank::StateVariable& lp, State& high, State& low,
+    float sample)
 {
-    lowPass.coefficients = Coefficients::makeLowPass(lastSampleRate, freq);
+    // one update gives every output; the low-pass stage uses its low-pass
+    // output and the high-pass stage its high-pass output
+    float v3 = sample - low.s2;
+    float v1 = lp.a1 * low.s1 + lp.a2 * v3;
+    float v2 = low.s2 + lp.a2 * low.s1 + lp.a3 * v3;
+    low.s1 = 2 * v1 - low.s1;
+    low.s2 = 2 * v2 - low.s2;
+    float lowPassed = v2;
+
+    v3 = lowPassed - high.s2;
+    v1 = hp.a1 * high.s1 + hp.a2 * v3;
+    v2 = high.s2 + hp.a2 * high.s1 + hp.a3 * v3;
+    high.s1 = 2 * v1 - high.s1;
+    high.s2 = 2 * v2 - high.s2;
+    return lowPassed - CoefficientTable::stateVariableDamping * v1 - v2;
 }
\ No newline at end of file
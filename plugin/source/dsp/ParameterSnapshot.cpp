@@ -0,0 +1,61 @@
+#include "ParameterSnapshot.h"
+#include <juce_core/juce_core.h>
+
+ParameterSnapshot::ParameterSnapshot()
+    : changed(0)
+{
+    for (size_t i = 0;i < numParameters;i++)
+    {
+        sources[i] = nullptr;
+        values[i] = 0;
+    }
+}
+
+void ParameterSnapshot::attach
+(size_t parameter, const std::atomic<float>* value)
+{
+    jassert(parameter < numParameters && value != nullptr);
+    sources[parameter] = value;
+    values[parameter] = value->load(std::memory_order_relaxed);
+    changed |= getMask(parameter);
+}
+
+void ParameterSnapshot::update()
+{
+    // the parameters are independent of each other, so nothing needs more
+    // than a relaxed load
+    Mask newlyChanged = 0;
+    for (size_t i = 0;i < numParameters;i++)
+    {
+        jassert(sources[i] != nullptr);
+        float value = sources[i]->load(std::memory_order_relaxed);
+        if (!juce::exactlyEqual(value, values[i]))
+        {
+            values[i] = value;
+            newlyChanged |= getMask(i);
+        }
+    }
+    changed = newlyChanged;
+}
+
+void ParameterSnapshot::markAllChanged()
+{
+    changed = getMask(0, numParameters);
+}
+
+float ParameterSnapshot::get(size_t parameter) const
+{
+    return values[parameter];
+}
+
+bool ParameterSnapshot::hasChanged(Mask parameters) const
+{
+    return (changed & parameters) != 0;
+}
+
+ParameterSnapshot::Mask ParameterSnapshot::getMask
+(size_t parameter, size_t count)
+{
+    Mask bits = count >= sizeof(Mask) * 8 ? ~(Mask) 0 : ((Mask) 1 << count) - 1;
+    return bits << parameter;
+}
\ No newline at end of file
@@ -0,0 +1,480 @@
+#include "SampleKernels.h"
+#include <bit>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64)
+#define SAMPLE_KERNELS_SSE 1
+#include <immintrin.h>
+#else
+#define SAMPLE_KERNELS_SSE 0
+#endif
+
+#if SAMPLE_KERNELS_SSE && defined(__AVX__)
+#define SAMPLE_KERNELS_AVX 1
+#else
+#define SAMPLE_KERNELS_AVX 0
+#endif
+
+// the hardware half precision conversions, in builds that target them
+#if SAMPLE_KERNELS_AVX && defined(__F16C__)
+#define SAMPLE_KERNELS_F16C 1
+#else
+#define SAMPLE_KERNELS_F16C 0
+#endif
+
+namespace SampleKernels
+{
+
+// Each vector kernel runs as many 8-wide (AVX) and then 4-wide (SSE) steps
+// as fit in the run and hands what remains (at most 3 samples) to the scalar
+// reference, so short runs either side of a wrap point stay vectorised.
+
+void mixRamped(float* output, size_t length, float startGain, float gainStep,
+    const RampedInput* inputs, size_t numInputs)
+{
+    // the output is scaled and every input summed into it in one pass, so
+    // each output sample is only loaded and stored once
+    size_t i = 0;
+#if SAMPLE_KERNELS_AVX
+    __m256 index8 = _mm256_setr_ps(1, 2, 3, 4, 5, 6, 7, 8);
+    for (;i + 8 <= length;i += 8)
+    {
+        __m256 gain = _mm256_add_ps(_mm256_set1_ps(startGain),
+            _mm256_mul_ps(_mm256_set1_ps(gainStep), index8));
+        __m256 y = _mm256_mul_ps(_mm256_loadu_ps(output + i), gain);
+        for (size_t n = 0;n < numInputs;n++)
+        {
+            const RampedInput& input = inputs[n];
+            __m256 inputGain = _mm256_add_ps(_mm256_set1_ps(input.startGain),
+                _mm256_mul_ps(_mm256_set1_ps(input.gainStep), index8));
+            __m256 x = _mm256_loadu_ps(input.samples + i);
+            y = _mm256_add_ps(y, _mm256_mul_ps(x, inputGain));
+        }
+        _mm256_storeu_ps(output + i, y);
+        index8 = _mm256_add_ps(index8, _mm256_set1_ps(8));
+    }
+#endif
+#if SAMPLE_KERNELS_SSE
+    __m128 index4 = _mm_add_ps(_mm_setr_ps(1, 2, 3, 4),
+        _mm_set1_ps(static_cast<float>(i)));
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128 gain = _mm_add_ps(_mm_set1_ps(startGain),
+            _mm_mul_ps(_mm_set1_ps(gainStep), index4));
+        __m128 y = _mm_mul_ps(_mm_loadu_ps(output + i), gain);
+        for (size_t n = 0;n < numInputs;n++)
+        {
+            const RampedInput& input = inputs[n];
+            __m128 inputGain = _mm_add_ps(_mm_set1_ps(input.startGain),
+                _mm_mul_ps(_mm_set1_ps(input.gainStep), index4));
+            __m128 x = _mm_loadu_ps(input.samples + i);
+            y = _mm_add_ps(y, _mm_mul_ps(x, inputGain));
+        }
+        _mm_storeu_ps(output + i, y);
+        index4 = _mm_add_ps(index4, _mm_set1_ps(4));
+    }
+#endif
+    mixRampedScalar(output + i, length - i, startGain, gainStep, inputs,
+        numInputs, i);
+}
+
+void snapToZero(float* samples, size_t length)
+{
+    // a sample is kept where its magnitude is above the threshold and
+    // masked to zero otherwise, so there's no branch per sample
+    size_t i = 0;
+#if SAMPLE_KERNELS_AVX
+    __m256 sign8 = _mm256_set1_ps(-0.0f);
+    __m256 threshold8 = _mm256_set1_ps(snapThreshold);
+    for (;i + 8 <= length;i += 8)
+    {
+        __m256 x = _mm256_loadu_ps(samples + i);
+        __m256 keep = _mm256_cmp_ps(_mm256_andnot_ps(sign8, x), threshold8,
+            _CMP_GT_OQ);
+        _mm256_storeu_ps(samples + i, _mm256_and_ps(x, keep));
+    }
+#endif
+#if SAMPLE_KERNELS_SSE
+    __m128 sign4 = _mm_set1_ps(-0.0f);
+    __m128 threshold4 = _mm_set1_ps(snapThreshold);
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128 x = _mm_loadu_ps(samples + i);
+        __m128 keep = _mm_cmpgt_ps(_mm_andnot_ps(sign4, x), threshold4);
+        _mm_storeu_ps(samples + i, _mm_and_ps(x, keep));
+    }
+#endif
+    snapToZeroScalar(samples + i, length - i);
+}
+
+size_t countSubnormals(const float* samples, size_t length)
+{
+    size_t count = 0;
+    for (size_t i = 0;i < length;i++)
+    {
+        if (std::fpclassify(samples[i]) == FP_SUBNORMAL)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+void interleave(float* frames, const float* left, const float* right,
+    size_t numFrames)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_SSE
+    for (;i + 4 <= numFrames;i += 4)
+    {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(frames + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(frames + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+#endif
+    interleaveScalar(frames + i * 2, left + i, right + i, numFrames - i);
+}
+
+void interleaveWithAddRamped(float* frames, const float* left,
+    const float* right, const float* addLeft, const float* addRight,
+    size_t numFrames, float startGain, float gainStep, size_t offset)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_SSE
+    __m128 start4 = _mm_set1_ps(startGain);
+    __m128 step4 = _mm_set1_ps(gainStep);
+    __m128 index4 = _mm_add_ps(_mm_setr_ps(1, 2, 3, 4),
+        _mm_set1_ps(static_cast<float>(offset)));
+    for (;i + 4 <= numFrames;i += 4)
+    {
+        __m128 gain = _mm_add_ps(start4, _mm_mul_ps(step4, index4));
+        __m128 l = _mm_add_ps(_mm_loadu_ps(left + i),
+            _mm_mul_ps(_mm_loadu_ps(addLeft + i), gain));
+        __m128 r = _mm_add_ps(_mm_loadu_ps(right + i),
+            _mm_mul_ps(_mm_loadu_ps(addRight + i), gain));
+        _mm_storeu_ps(frames + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(frames + i * 2 + 4, _mm_unpackhi_ps(l, r));
+        index4 = _mm_add_ps(index4, _mm_set1_ps(4));
+    }
+#endif
+    interleaveWithAddRampedScalar(frames + i * 2, left + i, right + i,
+        addLeft + i, addRight + i, numFrames - i, startGain, gainStep,
+        offset + i);
+}
+
+#if SAMPLE_KERNELS_SSE
+// the steps of the scalar conversions below, for four samples at a time.
+// Without F16C these are how half precision is converted, and the results
+// are the same as F16C's
+static __m128i floatToHalf4(__m128 samples)
+{
+    __m128i bits = _mm_castps_si128(samples);
+    __m128i sign = _mm_and_si128(bits, _mm_set1_epi32(INT32_MIN));
+    __m128i magnitude = _mm_xor_si128(bits, sign);
+
+    __m128i tooLarge = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x477fffff));
+    __m128i isNaN = _mm_cmpgt_epi32(magnitude, _mm_set1_epi32(0x7f800000));
+    __m128i infinity = _mm_or_si128(_mm_set1_epi32(0x7c00),
+        _mm_and_si128(isNaN, _mm_set1_epi32(0x0200)));
+
+    __m128i tooSmall = _mm_cmplt_epi32(magnitude, _mm_set1_epi32(0x38800000));
+    __m128 subnormalMagic = _mm_castsi128_ps(_mm_set1_epi32(0x3f000000));
+    __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(
+        _mm_castsi128_ps(magnitude), subnormalMagic)),
+        _mm_castps_si128(subnormalMagic));
+
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(magnitude, 13),
+        _mm_set1_epi32(1));
+    __m128i rebias = _mm_set1_epi32((15 - 127) * (1 << 23) + 0xfff);
+    __m128i normal = _mm_add_epi32(magnitude, rebias);
+    normal = _mm_srli_epi32(_mm_add_epi32(normal, odd), 13);
+
+    __m128i half = _mm_or_si128(_mm_and_si128(tooSmall, subnormal),
+        _mm_andnot_si128(tooSmall, normal));
+    half = _mm_or_si128(_mm_and_si128(tooLarge, infinity),
+        _mm_andnot_si128(tooLarge, half));
+    return _mm_or_si128(half, _mm_srli_epi32(sign, 16));
+}
+
+static __m128 halfToFloat4(__m128i packed)
+{
+    __m128i exponent = _mm_and_si128(packed, _mm_set1_epi32(0x7c00));
+    __m128i bits = _mm_slli_epi32(_mm_and_si128(packed,
+        _mm_set1_epi32(0x7fff)), 13);
+    __m128i isInfinite = _mm_cmpeq_epi32(exponent, _mm_set1_epi32(0x7c00));
+    __m128i isSubnormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+
+    __m128i bias = _mm_add_epi32(_mm_set1_epi32(112 << 23),
+        _mm_and_si128(isInfinite, _mm_set1_epi32(112 << 23)));
+    __m128 normal = _mm_castsi128_ps(_mm_add_epi32(bits, bias));
+    __m128 subnormal = _mm_mul_ps(_mm_cvtepi32_ps(_mm_and_si128(packed,
+        _mm_set1_epi32(0x03ff))), _mm_set1_ps(0x1.0p-24f));
+
+    __m128 mask = _mm_castsi128_ps(isSubnormal);
+    __m128 magnitude = _mm_or_ps(_mm_and_ps(mask, subnormal),
+        _mm_andnot_ps(mask, normal));
+    __m128i sign = _mm_slli_epi32(_mm_and_si128(packed,
+        _mm_set1_epi32(0x8000)), 16);
+    return _mm_or_ps(magnitude, _mm_castsi128_ps(sign));
+}
+
+// a uniform value in [-0.5, 0.5) from each lane's xorshift generator
+static __m128 nextDither4(__m128i& state)
+{
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+    state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+    state = _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    __m128i one = _mm_or_si128(_mm_srli_epi32(state, 9),
+        _mm_set1_epi32(0x3f800000));
+    return _mm_sub_ps(_mm_castsi128_ps(one), _mm_set1_ps(1.5f));
+}
+
+// four 32-bit values, each fitting in 16 bits, to the low half of a register
+static __m128i packLow16(__m128i values)
+{
+    // sign extending first makes the saturating pack an exact one
+    values = _mm_srai_epi32(_mm_slli_epi32(values, 16), 16);
+    return _mm_packs_epi32(values, values);
+}
+#endif
+
+void floatToHalf(uint16_t* packed, const float* samples, size_t length)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_F16C
+    for (;i + 8 <= length;i += 8)
+    {
+        __m128i half = _mm256_cvtps_ph(_mm256_loadu_ps(samples + i),
+            _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + i), half);
+    }
+#endif
+#if SAMPLE_KERNELS_SSE
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128i half = packLow16(floatToHalf4(_mm_loadu_ps(samples + i)));
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(packed + i), half);
+    }
+#endif
+    floatToHalfScalar(packed + i, samples + i, length - i);
+}
+
+void halfToFloat(float* samples, const uint16_t* packed, size_t length)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_F16C
+    for (;i + 8 <= length;i += 8)
+    {
+        __m128i half = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(packed + i));
+        _mm256_storeu_ps(samples + i, _mm256_cvtph_ps(half));
+    }
+#endif
+#if SAMPLE_KERNELS_SSE
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128i half = _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(packed + i));
+        half = _mm_unpacklo_epi16(half, _mm_setzero_si128());
+        _mm_storeu_ps(samples + i, halfToFloat4(half));
+    }
+#endif
+    halfToFloatScalar(samples + i, packed + i, length - i);
+}
+
+void floatToInt16Dithered(uint16_t* packed, const float* samples,
+    size_t length, DitherState& dither)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_SSE
+    __m128i state = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(dither.lanes));
+    __m128 scale = _mm_set1_ps(32768.0f / int16Range);
+    __m128 signBit = _mm_set1_ps(-0.0f);
+    __m128 halfStep = _mm_set1_ps(0.5f);
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128 x = _mm_mul_ps(_mm_loadu_ps(samples + i), scale);
+        __m128 noise = _mm_add_ps(nextDither4(state), nextDither4(state));
+        __m128 audible = _mm_cmpge_ps(_mm_andnot_ps(signBit, x), halfStep);
+        x = _mm_add_ps(x, _mm_and_ps(audible, noise));
+        x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-32768.0f)),
+            _mm_set1_ps(32767.0f));
+        __m128i value = _mm_cvtps_epi32(x);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(packed + i),
+            _mm_packs_epi32(value, value));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dither.lanes), state);
+#endif
+    floatToInt16DitheredScalar(packed + i, samples + i, length - i, dither);
+}
+
+void int16ToFloat(float* samples, const uint16_t* packed, size_t length)
+{
+    size_t i = 0;
+#if SAMPLE_KERNELS_SSE
+    __m128 scale = _mm_set1_ps(int16Range / 32768.0f);
+    for (;i + 4 <= length;i += 4)
+    {
+        __m128i value = _mm_loadl_epi64(
+            reinterpret_cast<const __m128i*>(packed + i));
+        value = _mm_srai_epi32(_mm_unpacklo_epi16(value, value), 16);
+        _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_cvtepi32_ps(value), scale));
+    }
+#endif
+    int16ToFloatScalar(samples + i, packed + i, length - i);
+}
+
+void mixRampedScalar(float* output, size_t length, float startGain,
+    float gainStep, const RampedInput* inputs, size_t numInputs,
+    size_t offset)
+{
+    for (size_t i = 0;i < length;i++)
+    {
+        float index = static_cast<float>(offset + i + 1);
+        float y = output[i] * (startGain + gainStep * index);
+        for (size_t n = 0;n < numInputs;n++)
+        {
+            const RampedInput& input = inputs[n];
+            y += input.samples[offset + i]
+                * (input.startGain + input.gainStep * index);
+        }
+        output[i] = y;
+    }
+}
+
+void snapToZeroScalar(float* samples, size_t length)
+{
+    for (size_t i = 0;i < length;i++)
+    {
+        if (!(samples[i] < -snapThreshold || samples[i] > snapThreshold))
+        {
+            samples[i] = 0;
+        }
+    }
+}
+
+void interleaveScalar(float* frames, const float* left, const float* right,
+    size_t numFrames)
+{
+    for (size_t i = 0;i < numFrames;i++)
+    {
+        frames[i * 2] = left[i];
+        frames[i * 2 + 1] = right[i];
+    }
+}
+
+void interleaveWithAddRampedScalar(float* frames, const float* left,
+    const float* right, const float* addLeft, const float* addRight,
+    size_t numFrames, float startGain, float gainStep, size_t offset)
+{
+    for (size_t i = 0;i < numFrames;i++)
+    {
+        float gain = startGain + gainStep * static_cast<float>(offset + i + 1);
+        frames[i * 2] = left[i] + addLeft[i] * gain;
+        frames[i * 2 + 1] = right[i] + addRight[i] * gain;
+    }
+}
+
+
+void floatToHalfScalar(uint16_t* packed, const float* samples, size_t length)
+{
+    for (size_t i = 0;i < length;i++)
+    {
+        uint32_t bits = std::bit_cast<uint32_t>(samples[i]);
+        uint32_t sign = bits & 0x80000000u;
+        uint32_t magnitude = bits ^ sign;
+
+        uint32_t half;
+        if (magnitude >= 0x47800000u)
+        {
+            // too large for half precision, infinite or not a number
+            half = magnitude > 0x7f800000u ? 0x7e00u : 0x7c00u;
+        }
+        else if (magnitude < 0x38800000u)
+        {
+            // a half precision subnormal (or zero), rounded by adding a
+            // magic number that shifts the bits kept to the bottom
+            float magic = std::bit_cast<float>(0x3f000000u);
+            float sum = std::bit_cast<float>(magnitude) + magic;
+            half = std::bit_cast<uint32_t>(sum) - 0x3f000000u;
+        }
+        else
+        {
+            // rebias the exponent, then round the dropped mantissa bits to
+            // nearest, breaking ties towards an even result
+            uint32_t odd = (magnitude >> 13) & 1;
+            half = (magnitude + 0xc8000fffu + odd) >> 13;
+        }
+        packed[i] = static_cast<uint16_t>(half | (sign >> 16));
+    }
+}
+
+void halfToFloatScalar(float* samples, const uint16_t* packed, size_t length)
+{
+    for (size_t i = 0;i < length;i++)
+    {
+        uint32_t half = packed[i];
+        uint32_t sign = (half & 0x8000u) << 16;
+        uint32_t exponent = half & 0x7c00u;
+        uint32_t bits = (half & 0x7fffu) << 13;
+
+        float magnitude;
+        if (exponent == 0)
+        {
+            // subnormal halves are normal floats, but are scaled from the
+            // mantissa so as not to pass through a subnormal float
+            magnitude = static_cast<float>(half & 0x03ffu) * 0x1.0p-24f;
+        }
+        else if (exponent == 0x7c00u)
+        {
+            magnitude = std::bit_cast<float>(bits + (224u << 23));
+        }
+        else
+        {
+            magnitude = std::bit_cast<float>(bits + (112u << 23));
+        }
+        samples[i] = std::bit_cast<float>(std::bit_cast<uint32_t>(magnitude)
+            | sign);
+    }
+}
+
+void floatToInt16DitheredScalar(uint16_t* packed, const float* samples,
+    size_t length, DitherState& dither)
+{
+    // sample i uses lane i % 4 of the dither, as the vector kernel does
+    auto next = [&dither](size_t lane)
+    {
+        uint32_t& state = dither.lanes[lane];
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return std::bit_cast<float>((state >> 9) | 0x3f800000u) - 1.5f;
+    };
+
+    for (size_t i = 0;i < length;i++)
+    {
+        float x = samples[i] * (32768.0f / int16Range);
+        float noise = next(i % 4);
+        noise += next(i % 4);
+        if (std::fabs(x) >= 0.5f)
+        {
+            x += noise;
+        }
+        x = std::fmin(std::fmax(x, -32768.0f), 32767.0f);
+        int16_t value = static_cast<int16_t>(std::lrint(x));
+        packed[i] = static_cast<uint16_t>(value);
+    }
+}
+
+void int16ToFloatScalar(float* samples, const uint16_t* packed, size_t length)
+{
+    for (size_t i = 0;i < length;i++)
+    {
+        int16_t value = static_cast<int16_t>(packed[i]);
+        samples[i] = static_cast<float>(value) * (int16Range / 32768.0f);
+    }
+}
+
+}
\ No newline at end of file
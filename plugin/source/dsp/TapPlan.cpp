@@ -0,0 +1,42 @@
+#include "TapPlan.h"
+
+TapPlan::TapPlan()
+    : numTaps(0), lastAudibleTaps(0), lastNumIntervals(0), lastInPlace(true),
+    built(false)
+{ }
+
+void TapPlan::update(uint32_t audibleTaps, size_t numIntervals, bool inPlace)
+{
+    if (built && audibleTaps == lastAudibleTaps
+        && numIntervals == lastNumIntervals && inPlace == lastInPlace)
+    {
+        return;
+    }
+
+    // the last interval first: its tap has the longest delay, so it starts
+    // lowest in the delay line and the taps run in address order. In place,
+    // this order is also what hands each tap's output on to the next
+    numTaps = 0;
+    for (size_t i = numIntervals - 1;i > 0;i--)
+    {
+        if (inPlace || (audibleTaps & (1u << i)) != 0)
+        {
+            intervals[numTaps++] = i;
+        }
+    }
+
+    lastAudibleTaps = audibleTaps;
+    lastNumIntervals = numIntervals;
+    lastInPlace = inPlace;
+    built = true;
+}
+
+size_t TapPlan::getNumTaps() const
+{
+    return numTaps;
+}
+
+size_t TapPlan::getInterval(size_t index) const
+{
+    return intervals[index];
+}
\ No newline at end of file
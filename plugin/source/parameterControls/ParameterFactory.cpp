@@ -175,7 +175,24 @@ std::unique_ptr<juce::AudioParameterFloat> createTimeParameter(std::string id,
 std::unique_ptr<juce::AudioParameterFloat> createTimeParameter
 (std::string id, std::string name, float min, float max, float step, float val)
 {
-    bool msDecimals = step < 1;
+    juce::NormalisableRange<float> range(min, max, step);
+    return createTimeParameter(id, name, range, val);
+}
+
+std::unique_ptr<juce::AudioParameterFloat> createSkewedTimeParameter
+(std::string id, std::string name, float min, float max, float step,
+    float centre, float val)
+{
+    juce::NormalisableRange<float> range(min, max, step);
+    range.setSkewForCentre(centre);
+    return createTimeParameter(id, name, range, val);
+}
+
+std::unique_ptr<juce::AudioParameterFloat> createTimeParameter
+(std::string id, std::string name, juce::NormalisableRange<float> range,
+    float val)
+{
+    bool msDecimals = range.interval < 1;
     juce::AudioParameterFloatAttributes attr;
 
     auto strFromValue = [msDecimals] (float value, int len) {
@@ -215,7 +232,6 @@ std::unique_ptr<juce::AudioParameterFloat> createTimeParameter
     };
     attr = attr.withValueFromStringFunction(valueFromStr);
 
-    juce::NormalisableRange<float> range(min, max, step);
     return std::make_unique<juce::AudioParameterFloat>(id, name, range, val,
         attr);
 }
@@ -228,6 +244,15 @@ std::unique_ptr<juce::AudioParameterChoice> createChoiceParameter
         defaultIndex);
 }
 
+std::unique_ptr<juce::AudioParameterChoice> createOptionParameter
+    (std::string id, std::string name, juce::StringArray options,
+    int defaultIndex)
+{
+    auto attr = juce::AudioParameterChoiceAttributes().withAutomatable(false);
+    return std::make_unique<juce::AudioParameterChoice>(id, name, options,
+        defaultIndex, attr);
+}
+
 std::unique_ptr<juce::AudioParameterChoice> createIntChoiceParameter
     (std::string id, std::string name, juce::Array<int> options,
     int defaultIndex)
@@ -0,0 +1,73 @@
+#include "CoefficientBank.h"
+#include "TestHelpers.h"
+
+class CoefficientBankTests : public juce::UnitTest
+{
+public:
+    CoefficientBankTests() : juce::UnitTest("Coefficient Bank", "DSP") { }
+
+    void runTest() override
+    {
+        beginTest("Unlinking after a cutoff moved while linked");
+        {
+            checkUnlinkAfterLinkedMove();
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 44100;
+    static constexpr int blockSize = 512;
+
+    // with both sides set the same and the same input in both channels, the
+    // two outputs should match. While the filters are linked, the right
+    // filters use the left coefficients, and the right bank only keeps its
+    // cutoffs in step. Once unlinked, it has to filter at the cutoff it was
+    // kept at, not the one it had when the link began
+    void checkUnlinkAfterLinkedMove()
+    {
+        PluginProcessor processor;
+        TestHelpers::setPlainParameters(processor);
+        TestHelpers::setParameter(processor, "filters-linked", 1);
+        TestHelpers::setParameter(processor,
+            processor.getIdForLeftIntervalAmp(1), 1);
+        TestHelpers::setParameter(processor,
+            processor.getIdForRightIntervalAmp(1), 1);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        const int moveBlock = 10;
+        const int unlinkBlock = 30;
+        const int numBlocks = 60;
+        juce::Random random(1);
+        float maxDifference = 0;
+        for (int block = 0;block < numBlocks;block++)
+        {
+            if (block == moveBlock)
+            {
+                TestHelpers::setParameter(processor, "left-low-pass", 2000);
+                TestHelpers::setParameter(processor, "right-low-pass", 2000);
+            }
+            if (block == unlinkBlock)
+            {
+                TestHelpers::setParameter(processor, "filters-linked", 0);
+            }
+
+            juce::AudioBuffer<float> buffer(2, blockSize);
+            TestHelpers::fillMonoBlock(buffer, random, 0.5f);
+            TestHelpers::processBlock(processor, buffer);
+
+            if (block > unlinkBlock)
+            {
+                buffer.addFrom(1, 0, buffer, 0, 0, blockSize, -1);
+                const float* difference = buffer.getReadPointer(1);
+                for (int i = 0;i < blockSize;i++)
+                {
+                    maxDifference = juce::jmax(maxDifference,
+                        std::abs(difference[i]));
+                }
+            }
+        }
+        expectLessThan(maxDifference, 1.0e-6f);
+    }
+};
+
+static CoefficientBankTests coefficientBankTests;
\ No newline at end of file
@@ -0,0 +1,60 @@
+#include "DelayMemory.h"
+#include "TestHelpers.h"
+
+class DelayMemoryTests : public juce::UnitTest
+{
+public:
+    DelayMemoryTests() : juce::UnitTest("Delay Memory", "DSP") { }
+
+    void runTest() override
+    {
+        beginTest("A mirrored buffer's writes past the end land at the start");
+        {
+            DelayMemory memory;
+            memory.allocate(pageMultiple);
+            if (memory.isMirrored())
+            {
+                memory.data()[pageMultiple + 3] = 0.25f;
+                expectEquals(memory.data()[3], 0.25f);
+            }
+        }
+
+        beginTest("Huge pages only back a mirrored buffer");
+        {
+            DelayMemory memory;
+            memory.allocate(hugePageMultiple);
+            expect(!memory.usesHugePages() || memory.isMirrored());
+
+            // too small to be mapped twice, so it's an ordinary allocation
+            memory.allocate(oddSize);
+            expect(!memory.isMirrored());
+            expect(!memory.usesHugePages());
+        }
+
+        beginTest("Locking is kept for memory allocated later, until undone");
+        {
+            DelayMemory memory;
+            memory.allocate(pageMultiple);
+            expect(!memory.isLocked());
+
+            // the system may refuse to lock it, but once it has, the lock
+            // carries over to the next allocation
+            memory.setLocked(true);
+            bool locked = memory.isLocked();
+            memory.allocate(pageMultiple);
+            expectEquals(memory.isLocked(), locked);
+
+            memory.setLocked(false);
+            expect(!memory.isLocked());
+            memory.release();
+            expect(!memory.isLocked());
+        }
+    }
+
+private:
+    static constexpr std::size_t pageMultiple = 16384;
+    static constexpr std::size_t hugePageMultiple = (2 << 20) / sizeof(float);
+    static constexpr std::size_t oddSize = 1000;
+};
+
+static DelayMemoryTests delayMemoryTests;
\ No newline at end of file
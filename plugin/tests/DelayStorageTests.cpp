@@ -0,0 +1,57 @@
+#include "TestHelpers.h"
+
+class DelayStorageTests : public juce::UnitTest
+{
+public:
+    DelayStorageTests() : juce::UnitTest("Delay Storage", "DSP") { }
+
+    void runTest() override
+    {
+        const char* formats[] = { "Float", "Half Float", "Dithered 16-bit" };
+        for (int format = 0;format < 3;format++)
+        {
+            beginTest(juce::String("A silent loop stays silent: ")
+                + formats[format]);
+            {
+                checkLoopedSilence(format);
+            }
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 44100;
+    static constexpr int blockSize = 512;
+
+    // at no falloff the loop has unity gain, so anything the delay line
+    // stores for silence goes round and round, and is requantised by every
+    // tap on the way
+    void checkLoopedSilence(int format)
+    {
+        PluginProcessor processor;
+        TestHelpers::setPlainParameters(processor);
+        TestHelpers::setParameter(processor, "delay-storage",
+            static_cast<float>(format));
+        TestHelpers::setParameter(processor, "loop", 1);
+        for (int i = 0;i < 12;i++)
+        {
+            TestHelpers::setParameter(processor,
+                processor.getIdForLeftIntervalAmp(i), 1);
+            TestHelpers::setParameter(processor,
+                processor.getIdForRightIntervalAmp(i), 1);
+        }
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        juce::Random random(1);
+        float peak = 0;
+        for (int block = 0;block < 400;block++)
+        {
+            juce::AudioBuffer<float> buffer(2, blockSize);
+            TestHelpers::fillBlock(buffer, random, 0);
+            TestHelpers::processBlock(processor, buffer);
+            peak = juce::jmax(peak, TestHelpers::getPeak(buffer));
+        }
+        expectEquals(peak, 0.0f);
+    }
+};
+
+static DelayStorageTests delayStorageTests;
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include "DspArena.h"
+#include <cstdint>
+#include "TestHelpers.h"
+
+class DspArenaTests : public juce::UnitTest
+{
+public:
+    DspArenaTests() : juce::UnitTest("DSP Arena", "DSP") { }
+
+    void runTest() override
+    {
+        beginTest("Each block starts on a cache line of its own");
+        {
+            DspArena arena;
+            float* floats = nullptr;
+            double* doubles = nullptr;
+            arena.plan();
+            allocateBlocks(arena, floats, doubles);
+            arena.commit();
+            allocateBlocks(arena, floats, doubles);
+
+            // 12 bytes of floats then 80 of doubles, each rounded up
+            expectEquals((int) arena.getSize(), 64 + 128);
+            expect(isAligned(floats) && isAligned(doubles));
+            expectEquals((int) (reinterpret_cast<char*>(doubles)
+                - reinterpret_cast<char*>(floats)), 64);
+        }
+
+        beginTest("The memory map lists every block");
+        {
+            DspArena arena;
+            float* floats = nullptr;
+            double* doubles = nullptr;
+            arena.plan();
+            allocateBlocks(arena, floats, doubles);
+            arena.commit();
+
+            juce::String map = arena.getMemoryMap();
+            expect(map.contains(juce::String(arena.getSize()) + " bytes"));
+            expect(map.contains("floats") && map.contains("doubles"));
+        }
+
+        beginTest("A prepared processor keeps its buffers in its arena");
+        {
+            PluginProcessor processor;
+            processor.prepareToPlay(44100, 512);
+            juce::String map = processor.getArenaMemoryMap();
+            for (const char* name : { "looped left", "looped right",
+                "wet left", "wet right" })
+            {
+                expect(map.contains(name), name);
+            }
+        }
+    }
+
+private:
+    static void allocateBlocks(DspArena& arena, float*& floats,
+        double*& doubles)
+    {
+        floats = arena.allocate<float>("floats", 3);
+        doubles = arena.allocate<double>("doubles", 10);
+    }
+
+    static bool isAligned(const void* pointer)
+    {
+        return reinterpret_cast<uintptr_t>(pointer) % DspArena::alignment == 0;
+    }
+};
+
+static DspArenaTests dspArenaTests;
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include "TestHelpers.h"
+
+class ParameterRampTests : public juce::UnitTest
+{
+public:
+    ParameterRampTests() : juce::UnitTest("Parameter Ramps", "DSP") { }
+
+    void runTest() override
+    {
+        beginTest("An amp glides over the whole of a host block");
+        {
+            PluginProcessor processor;
+            checkRamp(processor, 0, processor.getIdForLeftIntervalAmp(0), 0,
+                1);
+        }
+
+        beginTest("The wet level glides over the whole of a host block");
+        {
+            PluginProcessor processor;
+            checkRamp(processor, 1, "wet", 0, 100);
+        }
+
+        beginTest("The falloff glides over the whole of a host block");
+        {
+            PluginProcessor processor;
+            checkRamp(processor, 1, "falloff", 0, 50);
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 44100;
+
+    // larger than a sub-block, so the block is processed in several
+    static constexpr int blockSize = 1024;
+
+    // a steady input through one unfiltered tap, with one parameter moved
+    // between two blocks once the tap has filled. The output should follow
+    // one straight ramp across the whole of the next block, rather than
+    // arrive within its first sub-block
+    void checkRamp(PluginProcessor& processor, int interval,
+        const juce::String& id, float from, float to)
+    {
+        TestHelpers::setPlainParameters(processor);
+        TestHelpers::setParameter(processor, "left-filter-mix", 0);
+        TestHelpers::setParameter(processor, "right-filter-mix", 0);
+        TestHelpers::setParameter(processor,
+            processor.getIdForLeftIntervalAmp(interval), 1);
+        TestHelpers::setParameter(processor, id, from);
+        processor.prepareToPlay(sampleRate, blockSize);
+
+        juce::AudioBuffer<float> buffer(2, blockSize);
+        for (int block = 0;block < 2;block++)
+        {
+            fillSteadyBlock(buffer);
+            TestHelpers::processBlock(processor, buffer);
+        }
+        float start = buffer.getSample(0, blockSize - 1);
+
+        TestHelpers::setParameter(processor, id, to);
+        fillSteadyBlock(buffer);
+        TestHelpers::processBlock(processor, buffer);
+        float end = buffer.getSample(0, blockSize - 1);
+        expectGreaterThan(std::abs(end - start), 0.1f);
+
+        float maxError = 0;
+        for (int i = 0;i < blockSize;i++)
+        {
+            float progress = static_cast<float>(i) / blockSize;
+            float expected = start + (end - start) * progress;
+            maxError = juce::jmax(maxError,
+                std::abs(buffer.getSample(0, i) - expected));
+        }
+        expectLessThan(maxError, 1.0e-3f);
+    }
+
+    static void fillSteadyBlock(juce::AudioBuffer<float>& buffer)
+    {
+        for (int channel = 0;channel < buffer.getNumChannels();channel++)
+        {
+            juce::FloatVectorOperations::fill(
+                buffer.getWritePointer(channel), 0.5f, blockSize);
+        }
+    }
+};
+
+static ParameterRampTests parameterRampTests;
\ No newline at end of file
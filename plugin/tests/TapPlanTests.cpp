@@ -0,0 +1,102 @@
+#include "TapPlan.h"
+#include "TestHelpers.h"
+
+class TapPlanTests : public juce::UnitTest
+{
+public:
+    TapPlanTests() : juce::UnitTest("Tap Plan", "DSP") { }
+
+    void runTest() override
+    {
+        beginTest("In place, every tap runs");
+        {
+            TapPlan plan;
+            plan.update(1u << 2, 12, true);
+            expectEquals((int) plan.getNumTaps(), 11);
+            expectEquals((int) plan.getInterval(0), 11);
+        }
+
+        beginTest("Read only, only the taps that are heard run");
+        {
+            TapPlan plan;
+            plan.update((1u << 2) | (1u << 5), 12, false);
+            expectEquals((int) plan.getNumTaps(), 2);
+            expectEquals((int) plan.getInterval(0), 5);
+            expectEquals((int) plan.getInterval(1), 2);
+        }
+
+        beginTest("A tap turned up later hears its history at its own level");
+        {
+            checkTapTurnedUpLater();
+        }
+    }
+
+private:
+    static constexpr double sampleRate = 44100;
+    static constexpr int blockSize = 512;
+    static constexpr int lastTap = 11;
+
+    // the same input through two processors, with only the first two taps
+    // heard and a falloff that leaves the last tap far quieter than them.
+    // One has the last tap up all along, and the other turns it up once its
+    // history has been through every tap before it
+    void checkTapTurnedUpLater()
+    {
+        PluginProcessor always;
+        PluginProcessor later;
+        for (PluginProcessor* processor : { &always, &later })
+        {
+            TestHelpers::setPlainParameters(*processor);
+            TestHelpers::setParameter(*processor, "falloff", 50);
+            for (int i = 1;i <= 2;i++)
+            {
+                setTap(*processor, i, 1);
+            }
+            processor->prepareToPlay(sampleRate, blockSize);
+        }
+        setTap(always, lastTap, 1);
+
+        const int turnUpBlock = 40;
+        const int numBlocks = 80;
+        juce::Random alwaysRandom(1);
+        juce::Random laterRandom(1);
+        float maxDifference = 0;
+        for (int block = 0;block < numBlocks;block++)
+        {
+            if (block == turnUpBlock)
+            {
+                setTap(later, lastTap, 1);
+            }
+
+            juce::AudioBuffer<float> alwaysBuffer(2, blockSize);
+            juce::AudioBuffer<float> laterBuffer(2, blockSize);
+            TestHelpers::fillBlock(alwaysBuffer, alwaysRandom, 0.5f);
+            TestHelpers::fillBlock(laterBuffer, laterRandom, 0.5f);
+            TestHelpers::processBlock(always, alwaysBuffer);
+            TestHelpers::processBlock(later, laterBuffer);
+
+            // once the amp has ramped up, the two should agree
+            if (block > turnUpBlock)
+            {
+                laterBuffer.addFrom(0, 0, alwaysBuffer, 0, 0, blockSize, -1);
+                laterBuffer.addFrom(1, 0, alwaysBuffer, 1, 0, blockSize, -1);
+                maxDifference = juce::jmax(maxDifference,
+                    TestHelpers::getPeak(laterBuffer));
+            }
+        }
+
+        // the last tap is 66 dB down, so history it hears at the wrong level
+        // is far louder than the difference allowed here
+        expectLessThan(maxDifference, 1.0e-5f);
+    }
+
+    static void setTap(PluginProcessor& processor, int interval, float amp)
+    {
+        TestHelpers::setParameter(processor,
+            processor.getIdForLeftIntervalAmp(interval), amp);
+        TestHelpers::setParameter(processor,
+            processor.getIdForRightIntervalAmp(interval), amp);
+    }
+};
+
+static TapPlanTests tapPlanTests;
\ No newline at end of file
@@ -0,0 +1,90 @@
+#pragma once
+#include "PluginProcessor.h"
+
+// Drives a PluginProcessor outside of a host, the way the unit tests need it
+namespace TestHelpers
+{
+
+// sets a parameter from its plain value, as a host would
+inline void setParameter(PluginProcessor& processor, const juce::String& id,
+    float value)
+{
+    juce::RangedAudioParameter* parameter = processor.tree.getParameter(id);
+    parameter->setValueNotifyingHost(parameter->convertTo0to1(value));
+}
+
+// a short delay with every interval silent, open filters and nothing else
+// colouring the taps, which each test then changes what it needs from
+inline void setPlainParameters(PluginProcessor& processor)
+{
+    setParameter(processor, "delay-time", 20);
+    setParameter(processor, "tempo-sync", 0);
+    setParameter(processor, "num-intervals", 12);
+    setParameter(processor, "loop", 0);
+    setParameter(processor, "delays-linked", 0);
+    setParameter(processor, "filters-linked", 0);
+    setParameter(processor, "wet", 100);
+    setParameter(processor, "falloff", 0);
+    setParameter(processor, "left-high-pass", 20);
+    setParameter(processor, "left-low-pass", 20000);
+    setParameter(processor, "left-filter-mix", 100);
+    setParameter(processor, "right-high-pass", 20);
+    setParameter(processor, "right-low-pass", 20000);
+    setParameter(processor, "right-filter-mix", 100);
+    for (int i = 0;i < 16;i++)
+    {
+        setParameter(processor, processor.getIdForLeftIntervalAmp(i), 0);
+        setParameter(processor, processor.getIdForRightIntervalAmp(i), 0);
+    }
+}
+
+// fills a stereo block with noise, or with silence when level is zero
+inline void fillBlock(juce::AudioBuffer<float>& buffer, juce::Random& random,
+    float level)
+{
+    for (int channel = 0;channel < buffer.getNumChannels();channel++)
+    {
+        float* samples = buffer.getWritePointer(channel);
+        for (int i = 0;i < buffer.getNumSamples();i++)
+        {
+            samples[i] = (random.nextFloat() * 2 - 1) * level;
+        }
+    }
+}
+
+// the same noise in both channels, so a processor whose sides are set the
+// same should give the same output in both
+inline void fillMonoBlock(juce::AudioBuffer<float>& buffer,
+    juce::Random& random, float level)
+{
+    float* left = buffer.getWritePointer(0);
+    for (int i = 0;i < buffer.getNumSamples();i++)
+    {
+        left[i] = (random.nextFloat() * 2 - 1) * level;
+    }
+    buffer.copyFrom(1, 0, buffer, 0, 0, buffer.getNumSamples());
+}
+
+inline void processBlock(PluginProcessor& processor,
+    juce::AudioBuffer<float>& buffer)
+{
+    juce::MidiBuffer midi;
+    processor.processBlock(buffer, midi);
+}
+
+// the largest magnitude in the block, over both channels
+inline float getPeak(const juce::AudioBuffer<float>& buffer)
+{
+    float peak = 0;
+    for (int channel = 0;channel < buffer.getNumChannels();channel++)
+    {
+        const float* samples = buffer.getReadPointer(channel);
+        for (int i = 0;i < buffer.getNumSamples();i++)
+        {
+            peak = juce::jmax(peak, std::abs(samples[i]));
+        }
+    }
+    return peak;
+}
+
+}
\ No newline at end of file
@@ -0,0 +1,20 @@
+#include <juce_events/juce_events.h>
+
+int main()
+{
+    // the processor's parameters and async updates expect a message manager
+    juce::ScopedJuceInitialiser_GUI juceInitialiser;
+
+    juce::UnitTestRunner runner;
+    runner.setAssertOnFailure(false);
+    runner.runAllTests();
+
+    for (int i = 0;i < runner.getNumResults();i++)
+    {
+        if (runner.getResult(i)->failures > 0)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
\ No newline at end of file